@@ -0,0 +1,163 @@
+#ifndef AMBIENT_H
+#define AMBIENT_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+#include "bvh.hpp"
+#include "iosystem.hpp"
+#include "threadpool.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+// vertices per work item of the bake
+const std::size_t AMBIENT_CHUNK = 64;
+
+// ambient occlusion baked per vertex: rays cosine distributed over the hemisphere of each
+// vertex normal are traced against a BVH of the mesh, and the share that escapes within
+// distance becomes the vertex's occlusion value (255 = fully open), which the lit shaders
+// multiply into their ambient term; distance 0 uses a fifth of the model's size, and a BVH of
+// the mesh is built unless one is given
+bool bakeAmbientOcclusion(Mesh& mesh, unsigned int rays = 64, float distance = 0.0f, const BVH* bvh = NULL, ThreadPool* pool = NULL);
+// the baked values are cached per model, keyed by the vertex data and ray count so a changed
+// model (or a packed copy with its vertices reordered) bakes again
+bool readAmbientOcclusion(Mesh& mesh, const char* path, unsigned int rays, IOSystem* io = NULL);
+bool writeAmbientOcclusion(const Mesh& mesh, const char* path, unsigned int rays);
+
+// FNV-1a over the indexed vertices
+uint64_t ambientKey(const Mesh& mesh, unsigned int rays)
+{
+    uint64_t hash = 14695981039346656037ull ^ rays;
+    const unsigned char* bytes = (const unsigned char*)mesh.indexedVertices.data();
+    std::size_t size = sizeof(glm::vec3) * mesh.indexedVertices.size();
+    for (std::size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+bool bakeAmbientOcclusion(Mesh& mesh, unsigned int rays, float distance, const BVH* bvh, ThreadPool* pool)
+{
+    if (pool == NULL)
+        pool = defaultThreadPool();
+    if (mesh.stride() != 2 || mesh.indexedVertices.empty() || rays == 0)
+    {
+        std::cout << "ERROR::AMBIENT::NEEDS_INDEXED_VERTICES_WITH_NORMALS" << std::endl;
+        return false;
+    }
+
+    // 1. the hierarchy the rays are traced against
+    BVH built;
+    if (bvh == NULL)
+    {
+        built.build(mesh, pool);
+        bvh = &built;
+    }
+    if (bvh->nodes.empty())
+        return false;
+    float size = glm::length(mesh.largestVertex);
+    if (distance <= 0.0f)
+        distance = 0.2f * size;
+    float bias = 1e-4f * size;
+
+    // 2. every vertex on the pool: the same Hammersley set of directions for all, rotated by
+    // a per-vertex offset so neighbours do not share their banding
+    std::size_t count = mesh.indexedVertices.size() / 2;
+    std::vector<unsigned char> occlusion(count);
+    auto task = [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t v = first; v < last; v++)
+        {
+            glm::vec3 position = mesh.indexedVertices[v * 2];
+            glm::vec3 normal = mesh.indexedVertices[v * 2 + 1];
+            float length = glm::length(normal);
+            if (!(length > 0.0f))
+            {
+                occlusion[v] = 255;
+                continue;
+            }
+            normal /= length;
+            // an orthonormal basis around the normal (Duff et al.)
+            float sign = std::copysign(1.0f, normal.z);
+            float a = -1.0f / (sign + normal.z);
+            float b = normal.x * normal.y * a;
+            glm::vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+            glm::vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+            float offset = (float)((v * 2654435761u) & 0xffff) / 65536.0f;
+            unsigned int open = 0;
+            for (unsigned int r = 0; r < rays; r++)
+            {
+                // cosine distribution: uniform over the disk, lifted onto the hemisphere
+                uint32_t bits = r;
+                bits = (bits << 16) | (bits >> 16);
+                bits = ((bits & 0x55555555u) << 1) | ((bits & 0xaaaaaaaau) >> 1);
+                bits = ((bits & 0x33333333u) << 2) | ((bits & 0xccccccccu) >> 2);
+                bits = ((bits & 0x0f0f0f0fu) << 4) | ((bits & 0xf0f0f0f0u) >> 4);
+                bits = ((bits & 0x00ff00ffu) << 8) | ((bits & 0xff00ff00u) >> 8);
+                float u1 = (r + 0.5f) / rays;
+                float u2 = bits * 2.3283064365386963e-10f + offset;
+                u2 -= std::floor(u2);
+                float radius = std::sqrt(u1), phi = 6.28318530718f * u2;
+                glm::vec3 direction = tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) + normal * std::sqrt(std::max(0.0f, 1.0f - u1));
+                if (!bvh->occluded(Ray(position + normal * bias, direction, distance)))
+                    open++;
+            }
+            occlusion[v] = (unsigned char)((open * 255 + rays / 2) / rays);
+        }
+    };
+    pool->parallelFor(count, AMBIENT_CHUNK, task);
+    mesh.setOcclusion(occlusion);
+    return true;
+}
+
+bool readAmbientOcclusion(Mesh& mesh, const char* path, unsigned int rays, IOSystem* io)
+{
+    FileIOSystem files;
+    if (io == NULL)
+        io = &files;
+    std::string data;
+    if (!io->exists(path) || !io->readAll(path, data))
+        return false;
+
+    // header: magic, version, vertex count, key
+    std::size_t count = mesh.indexedVertices.size() / mesh.stride();
+    uint32_t version, vertices;
+    uint64_t key;
+    std::size_t headerSize = 4 + sizeof(version) + sizeof(vertices) + sizeof(key);
+    if (data.size() < headerSize || data.compare(0, 4, "AOCC") != 0)
+        return false;
+    std::memcpy(&version, &data[4], sizeof(version));
+    std::memcpy(&vertices, &data[8], sizeof(vertices));
+    std::memcpy(&key, &data[12], sizeof(key));
+    if (version != 1 || vertices != count || key != ambientKey(mesh, rays) || data.size() != headerSize + count)
+        return false;
+    mesh.setOcclusion(std::vector<unsigned char>(data.begin() + headerSize, data.end()));
+    return true;
+}
+
+bool writeAmbientOcclusion(const Mesh& mesh, const char* path, unsigned int rays)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out || mesh.occlusion.empty())
+    {
+        std::cout << "ERROR::AMBIENT::FILE_NOT_SUCCESSFULLY_WRITTEN" << std::endl;
+        return false;
+    }
+    uint32_t version = 1, vertices = mesh.occlusion.size();
+    uint64_t key = ambientKey(mesh, rays);
+    out.write("AOCC", 4);
+    out.write((const char*)&version, sizeof(version));
+    out.write((const char*)&vertices, sizeof(vertices));
+    out.write((const char*)&key, sizeof(key));
+    out.write((const char*)mesh.occlusion.data(), mesh.occlusion.size());
+    return (bool)out;
+}
+
+#endif
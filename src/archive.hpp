@@ -0,0 +1,150 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "iosystem.hpp"
+#include "inflate.hpp"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+
+// entries of a .zip archive that is opened (and ideally mapped) once; stored entries are
+// handed out as views into the archive, deflated ones are inflated into memory on open
+class ZipIOSystem : public IOSystem
+{
+public:
+    ZipIOSystem(const char* archivePath, IOSystem* base = NULL);
+    ~ZipIOSystem();
+    bool valid() const { return archive != NULL; }
+    bool exists(const char* path) const override;
+    IOStream* open(const char* path) override;
+private:
+    struct Entry
+    {
+        std::size_t offset; // of the local file header
+        std::size_t compressedSize;
+        std::size_t size;
+        unsigned int method; // 0 stored, 8 deflate
+    };
+    IOSystem* base;
+    IOStream* archive;
+    const char* bytes;
+    std::vector<char> ownedBytes;
+    std::size_t archiveSize;
+    std::unordered_map<std::string, Entry> entries;
+};
+
+ZipIOSystem::ZipIOSystem(const char* archivePath, IOSystem* base)
+{
+    static MMapIOSystem mapped;
+    this->base = base ? base : &mapped;
+    bytes = NULL;
+    archiveSize = 0;
+    archive = this->base->open(archivePath);
+    if (archive == NULL)
+        return;
+
+    // work on a single contiguous view of the archive
+    archiveSize = archive->fileSize();
+    bytes = archive->data();
+    if (bytes == NULL)
+    {
+        ownedBytes.resize(archiveSize);
+        archive->read(&ownedBytes[0], 1, archiveSize);
+        bytes = &ownedBytes[0];
+    }
+    auto u16 = [this](std::size_t at) { return (unsigned int)(unsigned char)bytes[at] | (unsigned int)(unsigned char)bytes[at + 1] << 8; };
+    auto u32 = [this, &u16](std::size_t at) { return (std::size_t)u16(at) | (std::size_t)u16(at + 2) << 16; };
+
+    // 1. find the end of central directory record (it is followed by at most a 64k comment)
+    std::size_t eocd = std::string::npos;
+    for (std::size_t at = archiveSize >= 22 ? archiveSize - 22 : 0; archiveSize >= 22; at--)
+    {
+        if (u32(at) == 0x06054b50)
+        {
+            eocd = at;
+            break;
+        }
+        if (at == 0 || archiveSize - at > 22 + 65535)
+            break;
+    }
+    if (eocd == std::string::npos)
+    {
+        std::cout << "ERROR::ZIP::INVALID_ARCHIVE" << std::endl;
+        this->base->close(archive);
+        archive = NULL;
+        return;
+    }
+
+    // 2. walk the central directory
+    std::size_t count = u16(eocd + 10);
+    std::size_t at = u32(eocd + 16);
+    for (std::size_t i = 0; i < count && at + 46 <= archiveSize && u32(at) == 0x02014b50; i++)
+    {
+        Entry entry;
+        entry.method = u16(at + 10);
+        entry.compressedSize = u32(at + 20);
+        entry.size = u32(at + 24);
+        entry.offset = u32(at + 42);
+        std::size_t nameLength = u16(at + 28);
+        std::string name(bytes + at + 46, nameLength);
+        // directories have a trailing slash and no data
+        if (!name.empty() && name.back() != '/')
+            entries[name] = entry;
+        at += 46 + nameLength + u16(at + 30) + u16(at + 32);
+    }
+}
+
+ZipIOSystem::~ZipIOSystem()
+{
+    if (archive)
+        base->close(archive);
+}
+
+bool ZipIOSystem::exists(const char* path) const
+{
+    return entries.count(path) > 0;
+}
+
+IOStream* ZipIOSystem::open(const char* path)
+{
+    auto found = entries.find(path);
+    if (found == entries.end())
+        return NULL;
+    const Entry& entry = found->second;
+
+    // the local header repeats name and extra field with possibly different lengths
+    std::size_t at = entry.offset;
+    if (at + 30 > archiveSize)
+        return NULL;
+    std::size_t nameLength = (unsigned char)bytes[at + 26] | (unsigned char)bytes[at + 27] << 8;
+    std::size_t extraLength = (unsigned char)bytes[at + 28] | (unsigned char)bytes[at + 29] << 8;
+    std::size_t dataAt = at + 30 + nameLength + extraLength;
+    if (dataAt + entry.compressedSize > archiveSize)
+        return NULL;
+
+    // stored: a view straight into the archive, no copy and no open
+    if (entry.method == 0)
+        return new MemoryIOStream(bytes + dataAt, entry.size);
+
+    if (entry.method == 8)
+    {
+        MemoryIOStream compressed(bytes + dataAt, entry.compressedSize);
+        InflateStream inflater(&compressed, true);
+        std::vector<char> out;
+        out.reserve(entry.size);
+        const char* chunk;
+        std::size_t size;
+        while (inflater.next(chunk, size))
+            out.insert(out.end(), chunk, chunk + size);
+        if (inflater.failed())
+            return NULL;
+        return new MemoryIOStream(std::move(out));
+    }
+
+    std::cout << "ERROR::ZIP::UNSUPPORTED_COMPRESSION_METHOD" << std::endl;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+#include "threadpool.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <tuple>
+#include <iostream>
+
+// one object of a static batch: an indexed mesh placed with a model matrix
+struct BatchObject
+{
+    const Mesh* mesh;
+    glm::mat4 model;
+    unsigned int shader;   // objects are grouped by shader, then material
+    unsigned int material;
+};
+
+// where an object ended up: its index range within its group and its world space bounds
+// (kept for culling, see StaticBatch::render)
+struct BatchRange
+{
+    unsigned int group;
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    unsigned int firstVertex;
+    unsigned int vertexCount;
+    glm::vec3 lower, upper;
+};
+
+// the objects sharing a shader, material and vertex layout, merged into one mesh
+struct BatchGroup
+{
+    unsigned int shader;
+    unsigned int material;
+    Mesh geometry;
+    std::vector<unsigned int> objects; // in index buffer order
+};
+
+// pre-transforms many small static meshes on the CPU and merges them into one vertex and one
+// index buffer per shader/material group, so hundreds of objects cost a handful of draws
+class StaticBatch
+{
+public:
+    std::vector<BatchObject> objects;
+    std::vector<BatchRange> ranges; // one per object, in the order they were added
+    std::vector<BatchGroup> groups; // sorted by shader, then material
+    glm::vec3 lower, upper;         // bounds of the whole batch
+
+    // the mesh has to be indexed (Mesh::buildIndices) and stay alive until build() returns
+    void add(const Mesh* mesh, const glm::mat4& model, unsigned int shader = 0, unsigned int material = 0);
+    // transforms and merges the objects, in parallel on the pool (the default one when NULL)
+    void build(ThreadPool* pool = NULL);
+    void load(unsigned int streams = STREAM_INTERLEAVED);
+    // draws one group; given a flag per object, only the visible ranges (adjacent ones merged)
+    void render(unsigned int group, const std::vector<char>* visible = NULL);
+    void unload();
+};
+
+void StaticBatch::add(const Mesh* mesh, const glm::mat4& model, unsigned int shader, unsigned int material)
+{
+    if (mesh->submeshes.empty())
+    {
+        std::cout << "ERROR::BATCH::MESH_NOT_INDEXED" << std::endl;
+        return;
+    }
+    objects.push_back(BatchObject{ mesh, model, shader, material });
+}
+
+void StaticBatch::build(ThreadPool* pool)
+{
+    if (pool == NULL)
+        pool = defaultThreadPool();
+    groups.clear();
+    ranges.assign(objects.size(), BatchRange());
+
+    // 1. group the objects by shader, material and vertex layout
+    std::vector<unsigned int> order(objects.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+    auto key = [&](unsigned int i)
+    {
+        const BatchObject& o = objects[i];
+        return std::make_tuple(o.shader, o.material, o.mesh->stride());
+    };
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return key(a) < key(b); });
+
+    // 2. lay out every object's vertex and index range within its group
+    for (unsigned int i : order)
+    {
+        const BatchObject& o = objects[i];
+        if (groups.empty() || key(groups.back().objects.front()) != key(i))
+        {
+            groups.push_back(BatchGroup());
+            groups.back().shader = o.shader;
+            groups.back().material = o.material;
+            groups.back().geometry.attributes = o.mesh->attributes;
+        }
+        BatchGroup& group = groups.back();
+        unsigned int indexCount = 0;
+        for (const SubMesh& sub : o.mesh->submeshes)
+            indexCount += sub.indexCount;
+        BatchRange& range = ranges[i];
+        range.group = groups.size() - 1;
+        range.firstVertex = group.objects.empty() ? 0 : ranges[group.objects.back()].firstVertex + ranges[group.objects.back()].vertexCount;
+        range.firstIndex = group.objects.empty() ? 0 : ranges[group.objects.back()].firstIndex + ranges[group.objects.back()].indexCount;
+        range.vertexCount = o.mesh->indexedVertices.size() / o.mesh->stride();
+        range.indexCount = indexCount;
+        group.objects.push_back(i);
+    }
+    for (BatchGroup& group : groups)
+    {
+        const BatchRange& last = ranges[group.objects.back()];
+        unsigned int vertexCount = last.firstVertex + last.vertexCount;
+        unsigned int indexCount = last.firstIndex + last.indexCount;
+        Mesh& geometry = group.geometry;
+        geometry.indexedVertices.resize(vertexCount * geometry.stride());
+        geometry.indexType = vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        if (geometry.indexType == GL_UNSIGNED_SHORT)
+            geometry.shortIndices.resize(indexCount);
+        else
+            geometry.longIndices.resize(indexCount);
+        geometry.submeshes.assign(1, SubMesh{ 0, indexCount, 0, vertexCount });
+    }
+
+    // 3. transform and copy every object into its slots (the ranges do not overlap)
+    auto task = [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t i = first; i < last; i++)
+        {
+            const BatchObject& o = objects[i];
+            BatchRange& range = ranges[i];
+            Mesh& geometry = groups[range.group].geometry;
+            unsigned int step = geometry.stride();
+            glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(o.model)));
+            range.lower = glm::vec3(std::numeric_limits<float>::max());
+            range.upper = glm::vec3(-std::numeric_limits<float>::max());
+            for (unsigned int v = 0; v < range.vertexCount; v++)
+            {
+                glm::vec3 p = glm::vec3(o.model * glm::vec4(o.mesh->indexedVertices[v * step], 1.0f));
+                geometry.indexedVertices[(range.firstVertex + v) * step] = p;
+                range.lower = glm::min(range.lower, p);
+                range.upper = glm::max(range.upper, p);
+                if (step == 2)
+                {
+                    glm::vec3 n = normalMatrix * o.mesh->indexedVertices[v * step + 1];
+                    float length = glm::length(n);
+                    geometry.indexedVertices[(range.firstVertex + v) * step + 1] = length > 0.0f ? n / length : n;
+                }
+            }
+            unsigned int at = range.firstIndex;
+            bool shortSource = o.mesh->indexType == GL_UNSIGNED_SHORT;
+            for (const SubMesh& sub : o.mesh->submeshes)
+            {
+                for (unsigned int k = sub.firstIndex; k < sub.firstIndex + sub.indexCount; k++, at++)
+                {
+                    unsigned int index = (shortSource ? o.mesh->shortIndices[k] : o.mesh->longIndices[k]) + sub.baseVertex + range.firstVertex;
+                    if (geometry.indexType == GL_UNSIGNED_SHORT)
+                        geometry.shortIndices[at] = index;
+                    else
+                        geometry.longIndices[at] = index;
+                }
+            }
+        }
+    };
+    pool->parallelFor(objects.size(), 4, task);
+
+    // 4. bounds of the groups and of the whole batch
+    lower = glm::vec3(std::numeric_limits<float>::max());
+    upper = glm::vec3(-std::numeric_limits<float>::max());
+    for (const BatchRange& range : ranges)
+    {
+        lower = glm::min(lower, range.lower);
+        upper = glm::max(upper, range.upper);
+    }
+    for (BatchGroup& group : groups)
+    {
+        glm::vec3& largest = group.geometry.largestVertex;
+        for (unsigned int i : group.objects)
+        {
+            glm::vec3 corner = glm::max(glm::abs(ranges[i].lower), glm::abs(ranges[i].upper));
+            if (glm::dot(corner, corner) > glm::dot(largest, largest))
+                largest = corner;
+        }
+    }
+}
+
+void StaticBatch::load(unsigned int streams)
+{
+    for (BatchGroup& group : groups)
+        group.geometry.load(streams);
+}
+
+void StaticBatch::render(unsigned int group, const std::vector<char>* visible)
+{
+    Mesh& geometry = groups[group].geometry;
+    if (visible == NULL)
+    {
+        geometry.render();
+        return;
+    }
+
+    // one draw per run of visible objects that are adjacent in the index buffer
+    glBindVertexArray(geometry.streams & STREAM_INTERLEAVED ? geometry.VAO : geometry.positionVAO);
+    unsigned int indexSize = geometry.indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    unsigned int runFirst = 0, runCount = 0;
+    for (unsigned int i : groups[group].objects)
+    {
+        const BatchRange& range = ranges[i];
+        if ((*visible)[i] && runCount > 0 && runFirst + runCount == range.firstIndex)
+        {
+            runCount += range.indexCount;
+            continue;
+        }
+        if (runCount > 0)
+            glDrawElements(GL_TRIANGLES, runCount, geometry.indexType, (void*)(std::size_t)(runFirst * indexSize));
+        runFirst = range.firstIndex;
+        runCount = (*visible)[i] ? range.indexCount : 0;
+    }
+    if (runCount > 0)
+        glDrawElements(GL_TRIANGLES, runCount, geometry.indexType, (void*)(std::size_t)(runFirst * indexSize));
+    glBindVertexArray(0);
+}
+
+void StaticBatch::unload()
+{
+    for (BatchGroup& group : groups)
+        group.geometry.unload();
+}
+
+#endif
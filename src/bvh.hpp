@@ -0,0 +1,814 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+#include "threadpool.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <thread>
+#include <atomic>
+
+// centroid bins per axis when a node looks for its split
+const unsigned int BVH_BINS = 16;
+// leaves are allowed up to this many triangles when no split is cheaper
+const unsigned int BVH_MAX_LEAF = 8;
+// rays traversed together by the packet query (one AVX register, two SSE ones)
+const unsigned int BVH_PACKET = 8;
+// traversal stack entries kept on the call stack; deeper trees use a heap allocated stack
+const unsigned int BVH_STACK = 64;
+// cost of a traversal step relative to a triangle test, for the SAH
+const float BVH_TRAVERSAL_COST = 1.0f;
+const unsigned int BVH_NO_HIT = 0xffffffffu;
+
+// 32 bytes, laid out depth first: an inner node's left child is the node right after it
+struct BVHNode
+{
+    glm::vec3 lower;
+    unsigned int offset;    // first triangle of a leaf, right child of an inner node
+    glm::vec3 upper;
+    unsigned int count;     // triangles of a leaf, 0 for inner nodes
+};
+
+struct Ray
+{
+    glm::vec3 origin;
+    glm::vec3 direction;    // need not be normalized, hits are reported in units of it
+    float tMax;
+    Ray(const glm::vec3& origin = glm::vec3(0.0f), const glm::vec3& direction = glm::vec3(0.0f, 0.0f, -1.0f),
+        float tMax = std::numeric_limits<float>::max())
+        : origin(origin), direction(direction), tMax(tMax) {}
+};
+
+struct RayHit
+{
+    float t = std::numeric_limits<float>::max();
+    unsigned int triangle = BVH_NO_HIT; // in the order the mesh lists its triangles
+    float u = 0.0f, v = 0.0f;           // barycentrics of the second and third corner
+    bool hit() const { return triangle != BVH_NO_HIT; }
+};
+
+// the rays of a packet component by component, so one slab test covers a node for all of them;
+// lanes without a ray have a negative tMax and never enter a box
+struct RayPacket
+{
+    float origin[3][BVH_PACKET];
+    float invDirection[3][BVH_PACKET];
+    float tMax[BVH_PACKET];     // the ray's tMax, lowered to its nearest hit so far
+};
+
+// bit r set when ray r of the packet enters the box before its tMax
+unsigned int packetBoxMask(const RayPacket& packet, const glm::vec3& lower, const glm::vec3& upper);
+unsigned int packetBoxMaskScalar(const RayPacket& packet, const glm::vec3& lower, const glm::vec3& upper);
+#ifdef TRANSFORM_X86
+unsigned int packetBoxMaskSSE(const RayPacket& packet, const glm::vec3& lower, const glm::vec3& upper);
+unsigned int packetBoxMaskAVX(const RayPacket& packet, const glm::vec3& lower, const glm::vec3& upper);
+#endif
+
+// the corners of a mesh's triangles, three each in draw order, from the index buffer when it
+// has one (with the indexed vertex of each corner in vertexIds) or else the parsed triangles
+void meshTriangleCorners(const Mesh& mesh, std::vector<glm::vec3>& corners, std::vector<unsigned int>* vertexIds = NULL);
+
+// bounding volume hierarchy over the triangles of a mesh, in the mesh's own space, for ray
+// queries (picking) that would otherwise scan every triangle: binned surface area heuristic
+// splits, the subtrees below the first levels built in parallel, flattened depth first
+class BVH
+{
+public:
+    std::vector<BVHNode> nodes;
+    std::vector<glm::vec3> corners;         // three per triangle, in leaf order
+    std::vector<unsigned int> triangleIds;  // the mesh triangle behind each leaf slot
+    std::vector<unsigned int> cornerVertices; // the indexed vertex behind each corner (meshes only)
+    unsigned int height = 0;                // levels below the root, which the traversal stacks are sized by
+
+    // the index buffer when the mesh has one (so it can be refitted later), otherwise the
+    // parsed triangles; triangles are numbered in draw order
+    bool build(const Mesh& mesh, ThreadPool* pool = NULL);
+    // three corners per triangle, with the indexed vertex of each corner if there is one
+    void build(const std::vector<glm::vec3>& triangleCorners, ThreadPool* pool = NULL,
+               const std::vector<unsigned int>* vertexIds = NULL);
+    // keeps the tree and recomputes the corners and node bounds bottom up from moved indexed
+    // vertices (of a tree built from a mesh): the subtrees built in parallel are refitted in
+    // parallel, then the levels above them; the tree gets looser as the vertices move apart
+    bool refit(const VertexSoA& vertices, ThreadPool* pool = NULL);
+    // expected cost of a random ray (SAH: node areas relative to the root's, traversal steps
+    // plus triangle tests), compared against the cost at build time to tell how far the
+    // refits have degraded the tree
+    float sahCost() const;
+
+    // nearest hit closer than ray.tMax
+    bool intersect(const Ray& ray, RayHit& hit) const;
+    // whether anything is hit closer than ray.tMax (stops at the first hit, for shadow and
+    // occlusion rays)
+    bool occluded(const Ray& ray) const;
+    // BVH_PACKET rays at a time sharing one traversal: every node gets one slab test for the
+    // whole packet (AVX or SSE), and is opened while any ray of the packet still enters it;
+    // the triangles of a leaf are only tested for those rays. suits coherent rays (a block of
+    // pixels, a picking rectangle)
+    void intersect(const Ray* rays, RayHit* hits, unsigned int count) const;
+private:
+    struct Build
+    {
+        std::vector<glm::vec3> lower, upper, centroid; // per triangle
+        std::vector<unsigned int> order;
+    };
+    // partitions [first, first + count) of the order and returns the size of its left part,
+    // 0 when the range is better off as a leaf
+    static unsigned int split(Build& b, unsigned int first, unsigned int count, const glm::vec3& lower, const glm::vec3& upper);
+    static void bounds(const Build& b, unsigned int first, unsigned int count, glm::vec3& lower, glm::vec3& upper);
+    // appends the subtree of a range to out, depth first, offsets relative to out
+    static void buildSubtree(Build& b, std::vector<BVHNode>& out, unsigned int first, unsigned int count);
+    bool intersectTriangle(const Ray& ray, unsigned int slot, RayHit& hit) const;
+    // room for a traversal that pushes both children of every node on a path
+    unsigned int* traversalStack(unsigned int (&local)[BVH_STACK], std::vector<unsigned int>& heap) const;
+    // the node ranges of the subtrees built in parallel, and the nodes above them in the
+    // order they were emitted (parents before children)
+    std::vector<std::pair<unsigned int, unsigned int>> subtreeNodes;
+    std::vector<unsigned int> topNodes;
+    void refitNode(unsigned int index, const VertexSoA& vertices);
+};
+
+// a BVH for a mesh deforming every frame: refitted after each change, and rebuilt on a
+// background thread once refits have made the SAH cost rebuildRatio times what it was after
+// the last build; the rebuilt tree is refitted to the latest vertices when it is swapped in
+class DynamicBVH
+{
+public:
+    float rebuildRatio = 1.5f;
+    unsigned int rebuilds = 0;
+
+    ~DynamicBVH();
+    bool build(const Mesh& mesh, ThreadPool* pool = NULL);
+    // after the indexed vertices changed
+    void update(const VertexSoA& vertices, ThreadPool* pool = NULL);
+    const BVH& bvh() const { return current; }
+    // current SAH cost over the cost after the last build
+    float costRatio() const;
+private:
+    BVH current, next;
+    float builtCost = 0.0f;
+    float nextCost = 0.0f;
+    std::thread builder;
+    std::atomic<bool> nextReady{ false };
+    bool building = false;
+};
+
+// the distance the ray enters the box at, or infinity when it misses it before tMax
+inline float rayBoxEntry(const glm::vec3& origin, const glm::vec3& invDirection, float tMax, const glm::vec3& lower, const glm::vec3& upper)
+{
+    glm::vec3 t0 = (lower - origin) * invDirection;
+    glm::vec3 t1 = (upper - origin) * invDirection;
+    glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float leave = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= leave ? enter : std::numeric_limits<float>::infinity();
+}
+
+unsigned int packetBoxMaskScalar(const RayPacket& packet, const glm::vec3& lower, const glm::vec3& upper)
+{
+    unsigned int mask = 0;
+    for (unsigned int r = 0; r < BVH_PACKET; r++)
+    {
+        glm::vec3 origin(packet.origin[0][r], packet.origin[1][r], packet.origin[2][r]);
+        glm::vec3 invDirection(packet.invDirection[0][r], packet.invDirection[1][r], packet.invDirection[2][r]);
+        if (rayBoxEntry(origin, invDirection, packet.tMax[r], lower, upper) != std::numeric_limits<float>::infinity())
+            mask |= 1u << r;
+    }
+    return mask;
+}
+
+#ifdef TRANSFORM_X86
+static_assert(BVH_PACKET % 8 == 0, "the vector slab tests take the packet 8 or 4 rays at a time");
+
+unsigned int packetBoxMaskSSE(const RayPacket& packet, const glm::vec3& lower, const glm::vec3& upper)
+{
+    // the same steps as rayBoxEntry, 4 rays per instruction
+    unsigned int mask = 0;
+    for (unsigned int r = 0; r < BVH_PACKET; r += 4)
+    {
+        __m128 enter = _mm_setzero_ps();
+        __m128 leave = _mm_loadu_ps(&packet.tMax[r]);
+        for (int c = 0; c < 3; c++)
+        {
+            __m128 origin = _mm_loadu_ps(&packet.origin[c][r]);
+            __m128 invDirection = _mm_loadu_ps(&packet.invDirection[c][r]);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lower[c]), origin), invDirection);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(upper[c]), origin), invDirection);
+            enter = _mm_max_ps(enter, _mm_min_ps(t0, t1));
+            leave = _mm_min_ps(leave, _mm_max_ps(t0, t1));
+        }
+        mask |= (unsigned int)_mm_movemask_ps(_mm_cmple_ps(enter, leave)) << r;
+    }
+    return mask;
+}
+
+__attribute__((target("avx")))
+unsigned int packetBoxMaskAVX(const RayPacket& packet, const glm::vec3& lower, const glm::vec3& upper)
+{
+    unsigned int mask = 0;
+    for (unsigned int r = 0; r < BVH_PACKET; r += 8)
+    {
+        __m256 enter = _mm256_setzero_ps();
+        __m256 leave = _mm256_loadu_ps(&packet.tMax[r]);
+        for (int c = 0; c < 3; c++)
+        {
+            __m256 origin = _mm256_loadu_ps(&packet.origin[c][r]);
+            __m256 invDirection = _mm256_loadu_ps(&packet.invDirection[c][r]);
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(lower[c]), origin), invDirection);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(upper[c]), origin), invDirection);
+            enter = _mm256_max_ps(enter, _mm256_min_ps(t0, t1));
+            leave = _mm256_min_ps(leave, _mm256_max_ps(t0, t1));
+        }
+        mask |= (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(enter, leave, _CMP_LE_OQ)) << r;
+    }
+    return mask;
+}
+#endif
+
+unsigned int packetBoxMask(const RayPacket& packet, const glm::vec3& lower, const glm::vec3& upper)
+{
+#ifdef TRANSFORM_X86
+    // AVX2 machines have AVX
+    static const bool avx = transformHasAVX2();
+    return avx ? packetBoxMaskAVX(packet, lower, upper) : packetBoxMaskSSE(packet, lower, upper);
+#else
+    return packetBoxMaskScalar(packet, lower, upper);
+#endif
+}
+
+inline float surfaceArea(const glm::vec3& lower, const glm::vec3& upper)
+{
+    glm::vec3 d = glm::max(upper - lower, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+void meshTriangleCorners(const Mesh& mesh, std::vector<glm::vec3>& corners, std::vector<unsigned int>* vertexIds)
+{
+    unsigned int step = mesh.stride();
+    std::size_t first = corners.size();
+    if (!mesh.submeshes.empty())
+    {
+        for (const SubMesh& sub : mesh.submeshes)
+            for (unsigned int k = sub.firstIndex; k < sub.firstIndex + sub.indexCount; k++)
+            {
+                unsigned int v = (mesh.indexType == GL_UNSIGNED_SHORT ? mesh.shortIndices[k] : mesh.longIndices[k]) + sub.baseVertex;
+                corners.push_back(mesh.indexedVertices[v * step]);
+                if (vertexIds != NULL)
+                    vertexIds->push_back(v);
+            }
+    }
+    else
+    {
+        for (std::size_t c = 0; c < mesh.triangles.size(); c += step)
+            corners.push_back(mesh.triangles[c]);
+    }
+    corners.resize(first + (corners.size() - first) / 3 * 3);
+}
+
+bool BVH::build(const Mesh& mesh, ThreadPool* pool)
+{
+    std::vector<glm::vec3> triangleCorners;
+    std::vector<unsigned int> vertexIds;
+    meshTriangleCorners(mesh, triangleCorners, &vertexIds);
+    vertexIds.resize(std::min(vertexIds.size(), triangleCorners.size()));
+    build(triangleCorners, pool, vertexIds.empty() ? NULL : &vertexIds);
+    return !nodes.empty();
+}
+
+void BVH::bounds(const Build& b, unsigned int first, unsigned int count, glm::vec3& lower, glm::vec3& upper)
+{
+    lower = glm::vec3(std::numeric_limits<float>::max());
+    upper = glm::vec3(-std::numeric_limits<float>::max());
+    for (unsigned int i = first; i < first + count; i++)
+    {
+        lower = glm::min(lower, b.lower[b.order[i]]);
+        upper = glm::max(upper, b.upper[b.order[i]]);
+    }
+}
+
+unsigned int BVH::split(Build& b, unsigned int first, unsigned int count, const glm::vec3& lower, const glm::vec3& upper)
+{
+    if (count <= 1)
+        return 0;
+
+    // 1. bin the centroids along each axis and sweep for the cheapest plane
+    glm::vec3 centroidLower(std::numeric_limits<float>::max()), centroidUpper(-std::numeric_limits<float>::max());
+    for (unsigned int i = first; i < first + count; i++)
+    {
+        centroidLower = glm::min(centroidLower, b.centroid[b.order[i]]);
+        centroidUpper = glm::max(centroidUpper, b.centroid[b.order[i]]);
+    }
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    unsigned int bestBin = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float extent = centroidUpper[axis] - centroidLower[axis];
+        if (!(extent > 0.0f))
+            continue;
+        float scale = BVH_BINS / extent;
+        unsigned int binCount[BVH_BINS] = {};
+        glm::vec3 binLower[BVH_BINS], binUpper[BVH_BINS];
+        std::fill(binLower, binLower + BVH_BINS, glm::vec3(std::numeric_limits<float>::max()));
+        std::fill(binUpper, binUpper + BVH_BINS, glm::vec3(-std::numeric_limits<float>::max()));
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            unsigned int t = b.order[i];
+            unsigned int bin = std::min(BVH_BINS - 1, (unsigned int)((b.centroid[t][axis] - centroidLower[axis]) * scale));
+            binCount[bin]++;
+            binLower[bin] = glm::min(binLower[bin], b.lower[t]);
+            binUpper[bin] = glm::max(binUpper[bin], b.upper[t]);
+        }
+        // areas and counts left of each plane, then the sweep back from the right
+        float leftArea[BVH_BINS];
+        unsigned int leftCount[BVH_BINS];
+        glm::vec3 l(std::numeric_limits<float>::max()), u(-std::numeric_limits<float>::max());
+        unsigned int n = 0;
+        for (unsigned int i = 0; i + 1 < BVH_BINS; i++)
+        {
+            n += binCount[i];
+            l = glm::min(l, binLower[i]);
+            u = glm::max(u, binUpper[i]);
+            leftCount[i] = n;
+            leftArea[i] = n > 0 ? surfaceArea(l, u) : 0.0f;
+        }
+        l = glm::vec3(std::numeric_limits<float>::max());
+        u = glm::vec3(-std::numeric_limits<float>::max());
+        n = 0;
+        for (unsigned int i = BVH_BINS - 1; i > 0; i--)
+        {
+            n += binCount[i];
+            l = glm::min(l, binLower[i]);
+            u = glm::max(u, binUpper[i]);
+            if (n == 0 || leftCount[i - 1] == 0)
+                continue;
+            float cost = leftArea[i - 1] * leftCount[i - 1] + surfaceArea(l, u) * n;
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = i;
+            }
+        }
+    }
+
+    // 2. a leaf when splitting (one traversal step plus both halves) does not pay off, or when
+    // every centroid is in the same place
+    float area = surfaceArea(lower, upper);
+    bool cheaper = bestAxis >= 0 && (area <= 0.0f || BVH_TRAVERSAL_COST + bestCost / area < (float)count);
+    if (!cheaper && count <= BVH_MAX_LEAF)
+        return 0;
+    if (bestAxis < 0)
+        return count / 2;
+
+    // 3. partition the order around the plane
+    float scale = BVH_BINS / (centroidUpper[bestAxis] - centroidLower[bestAxis]);
+    auto middle = std::partition(b.order.begin() + first, b.order.begin() + first + count, [&](unsigned int t)
+    {
+        return std::min(BVH_BINS - 1, (unsigned int)((b.centroid[t][bestAxis] - centroidLower[bestAxis]) * scale)) < bestBin;
+    });
+    return (unsigned int)(middle - (b.order.begin() + first));
+}
+
+void BVH::buildSubtree(Build& b, std::vector<BVHNode>& out, unsigned int first, unsigned int count)
+{
+    unsigned int index = out.size();
+    out.push_back(BVHNode());
+    bounds(b, first, count, out[index].lower, out[index].upper);
+    unsigned int left = split(b, first, count, out[index].lower, out[index].upper);
+    if (left == 0)
+    {
+        out[index].offset = first;
+        out[index].count = count;
+        return;
+    }
+    out[index].count = 0;
+    buildSubtree(b, out, first, left);
+    out[index].offset = out.size();
+    buildSubtree(b, out, first + left, count - left);
+}
+
+void BVH::build(const std::vector<glm::vec3>& triangleCorners, ThreadPool* pool, const std::vector<unsigned int>* vertexIds)
+{
+    if (pool == NULL)
+        pool = defaultThreadPool();
+    nodes.clear();
+    corners.clear();
+    triangleIds.clear();
+    cornerVertices.clear();
+    subtreeNodes.clear();
+    topNodes.clear();
+    height = 0;
+    unsigned int numTriangles = triangleCorners.size() / 3;
+    if (numTriangles == 0)
+        return;
+
+    // 1. per triangle bounds and centroids
+    Build b;
+    b.lower.resize(numTriangles);
+    b.upper.resize(numTriangles);
+    b.centroid.resize(numTriangles);
+    b.order.resize(numTriangles);
+    for (unsigned int t = 0; t < numTriangles; t++)
+    {
+        const glm::vec3* c = &triangleCorners[t * 3];
+        b.lower[t] = glm::min(glm::min(c[0], c[1]), c[2]);
+        b.upper[t] = glm::max(glm::max(c[0], c[1]), c[2]);
+        b.centroid[t] = (b.lower[t] + b.upper[t]) * 0.5f;
+        b.order[t] = t;
+    }
+
+    // 2. the first levels on this thread, until there are a few ranges per thread; the ranges
+    // are disjoint parts of the order, so their subtrees are built in parallel
+    struct TopNode
+    {
+        BVHNode node;
+        int subtree;    // index into the subtrees, -1 for a split node
+        int left, right;
+    };
+    std::vector<TopNode> top;
+    std::vector<std::pair<unsigned int, unsigned int>> ranges; // first, count
+    // (as many as the machine has threads for, whatever the pool, since refits use them too)
+    unsigned int topDepth = 0;
+    while ((1u << topDepth) < std::max(pool->size(), std::thread::hardware_concurrency()) * 4)
+        topDepth++;
+    auto expand = [&](auto& self, unsigned int first, unsigned int count, unsigned int depth) -> int
+    {
+        int index = top.size();
+        top.push_back(TopNode{ BVHNode(), -1, -1, -1 });
+        bounds(b, first, count, top[index].node.lower, top[index].node.upper);
+        unsigned int left = depth < topDepth && count > 1024 ? split(b, first, count, top[index].node.lower, top[index].node.upper) : 0;
+        if (left == 0)
+        {
+            top[index].subtree = ranges.size();
+            ranges.push_back(std::make_pair(first, count));
+            return index;
+        }
+        int l = self(self, first, left, depth + 1);
+        int r = self(self, first + left, count - left, depth + 1);
+        top[index].left = l;
+        top[index].right = r;
+        return index;
+    };
+    expand(expand, 0, numTriangles, 0);
+    std::vector<std::vector<BVHNode>> subtrees(ranges.size());
+    auto task = [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t s = first; s < last; s++)
+            buildSubtree(b, subtrees[s], ranges[s].first, ranges[s].second);
+    };
+    pool->parallelFor(ranges.size(), 1, task);
+
+    // 3. stitch the top levels and the subtrees into one depth first array
+    auto emit = [&](auto& self, int index) -> void
+    {
+        const TopNode& t = top[index];
+        if (t.subtree >= 0)
+        {
+            unsigned int base = nodes.size();
+            for (BVHNode node : subtrees[t.subtree])
+            {
+                if (node.count == 0)
+                    node.offset += base;
+                nodes.push_back(node);
+            }
+            subtreeNodes.push_back(std::make_pair(base, (unsigned int)nodes.size()));
+            return;
+        }
+        unsigned int at = nodes.size();
+        topNodes.push_back(at);
+        nodes.push_back(t.node);
+        nodes[at].count = 0;
+        self(self, t.left);
+        nodes[at].offset = nodes.size();
+        self(self, t.right);
+    };
+    emit(emit, 0);
+    // the height, from the depth first layout: children come after their parent
+    std::vector<unsigned int> levels(nodes.size(), 0);
+    for (unsigned int i = 0; i < nodes.size(); i++)
+    {
+        height = std::max(height, levels[i]);
+        if (nodes[i].count == 0)
+            levels[i + 1] = levels[nodes[i].offset] = levels[i] + 1;
+    }
+
+    // 4. the triangles in leaf order, so a leaf reads one contiguous run
+    corners.resize(numTriangles * 3);
+    triangleIds = b.order;
+    for (unsigned int i = 0; i < numTriangles; i++)
+        std::copy(&triangleCorners[b.order[i] * 3], &triangleCorners[b.order[i] * 3] + 3, &corners[i * 3]);
+    if (vertexIds != NULL && vertexIds->size() == triangleCorners.size())
+    {
+        cornerVertices.resize(numTriangles * 3);
+        for (unsigned int i = 0; i < numTriangles; i++)
+            std::copy(&(*vertexIds)[b.order[i] * 3], &(*vertexIds)[b.order[i] * 3] + 3, &cornerVertices[i * 3]);
+    }
+}
+
+void BVH::refitNode(unsigned int index, const VertexSoA& vertices)
+{
+    BVHNode& node = nodes[index];
+    if (node.count == 0)
+    {
+        node.lower = glm::min(nodes[index + 1].lower, nodes[node.offset].lower);
+        node.upper = glm::max(nodes[index + 1].upper, nodes[node.offset].upper);
+        return;
+    }
+    node.lower = glm::vec3(std::numeric_limits<float>::max());
+    node.upper = glm::vec3(-std::numeric_limits<float>::max());
+    for (unsigned int c = node.offset * 3; c < (node.offset + node.count) * 3; c++)
+    {
+        corners[c] = vertices.position(cornerVertices[c]);
+        node.lower = glm::min(node.lower, corners[c]);
+        node.upper = glm::max(node.upper, corners[c]);
+    }
+}
+
+bool BVH::refit(const VertexSoA& vertices, ThreadPool* pool)
+{
+    if (nodes.empty() || cornerVertices.size() != corners.size())
+        return false;
+    if (*std::max_element(cornerVertices.begin(), cornerVertices.end()) >= vertices.count)
+        return false;
+    if (pool == NULL)
+        pool = defaultThreadPool();
+
+    // 1. every leaf is inside one of the subtrees, whose nodes follow their parents, so each
+    // is refitted back to front independently of the others
+    auto task = [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t s = first; s < last; s++)
+            for (unsigned int i = subtreeNodes[s].second; i-- > subtreeNodes[s].first;)
+                refitNode(i, vertices);
+    };
+    pool->parallelFor(subtreeNodes.size(), 1, task);
+
+    // 2. the few levels above them
+    for (auto it = topNodes.rbegin(); it != topNodes.rend(); ++it)
+        refitNode(*it, vertices);
+    return true;
+}
+
+float BVH::sahCost() const
+{
+    if (nodes.empty())
+        return 0.0f;
+    float rootArea = surfaceArea(nodes[0].lower, nodes[0].upper);
+    if (!(rootArea > 0.0f))
+        return 0.0f;
+    double cost = 0.0;
+    for (const BVHNode& node : nodes)
+        cost += surfaceArea(node.lower, node.upper) * (node.count > 0 ? (float)node.count : BVH_TRAVERSAL_COST);
+    return (float)(cost / rootArea);
+}
+
+bool BVH::intersectTriangle(const Ray& ray, unsigned int slot, RayHit& hit) const
+{
+    // Moller-Trumbore, both sides
+    const glm::vec3* c = &corners[slot * 3];
+    glm::vec3 edge1 = c[1] - c[0], edge2 = c[2] - c[0];
+    glm::vec3 p = glm::cross(ray.direction, edge2);
+    float det = glm::dot(edge1, p);
+    if (std::abs(det) < 1e-12f)
+        return false;
+    float invDet = 1.0f / det;
+    glm::vec3 s = ray.origin - c[0];
+    float u = glm::dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(ray.direction, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+    float t = glm::dot(edge2, q) * invDet;
+    if (t < 0.0f || t >= hit.t || t > ray.tMax)
+        return false;
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    hit.triangle = triangleIds[slot];
+    return true;
+}
+
+unsigned int* BVH::traversalStack(unsigned int (&local)[BVH_STACK], std::vector<unsigned int>& heap) const
+{
+    // a path holds height + 1 nodes, and each step down leaves at most one sibling behind
+    if (height + 2 <= BVH_STACK)
+        return local;
+    heap.resize(height + 2);
+    return heap.data();
+}
+
+bool BVH::intersect(const Ray& ray, RayHit& hit) const
+{
+    hit = RayHit();
+    if (nodes.empty())
+        return false;
+    glm::vec3 invDirection = 1.0f / ray.direction;
+    unsigned int local[BVH_STACK];
+    std::vector<unsigned int> heap;
+    unsigned int* stack = traversalStack(local, heap);
+    unsigned int depth = 0;
+    unsigned int index = 0;
+    if (rayBoxEntry(ray.origin, invDirection, ray.tMax, nodes[0].lower, nodes[0].upper) == std::numeric_limits<float>::infinity())
+        return false;
+    while (true)
+    {
+        const BVHNode& node = nodes[index];
+        if (node.count > 0)
+        {
+            for (unsigned int i = node.offset; i < node.offset + node.count; i++)
+                intersectTriangle(ray, i, hit);
+        }
+        else
+        {
+            // the nearer child first, the other one on the stack
+            unsigned int near = index + 1, far = node.offset;
+            float tNear = rayBoxEntry(ray.origin, invDirection, std::min(ray.tMax, hit.t), nodes[near].lower, nodes[near].upper);
+            float tFar = rayBoxEntry(ray.origin, invDirection, std::min(ray.tMax, hit.t), nodes[far].lower, nodes[far].upper);
+            if (tFar < tNear)
+            {
+                std::swap(near, far);
+                std::swap(tNear, tFar);
+            }
+            if (tNear != std::numeric_limits<float>::infinity())
+            {
+                if (tFar != std::numeric_limits<float>::infinity())
+                    stack[depth++] = far;
+                index = near;
+                continue;
+            }
+        }
+        // the next subtree still in front of the nearest hit
+        bool found = false;
+        while (depth > 0 && !found)
+        {
+            index = stack[--depth];
+            found = rayBoxEntry(ray.origin, invDirection, std::min(ray.tMax, hit.t), nodes[index].lower, nodes[index].upper) != std::numeric_limits<float>::infinity();
+        }
+        if (!found)
+            break;
+    }
+    return hit.hit();
+}
+
+bool BVH::occluded(const Ray& ray) const
+{
+    if (nodes.empty())
+        return false;
+    glm::vec3 invDirection = 1.0f / ray.direction;
+    unsigned int local[BVH_STACK];
+    std::vector<unsigned int> heap;
+    unsigned int* stack = traversalStack(local, heap);
+    unsigned int depth = 0;
+    stack[depth++] = 0;
+    RayHit hit;
+    while (depth > 0)
+    {
+        const BVHNode& node = nodes[stack[--depth]];
+        if (rayBoxEntry(ray.origin, invDirection, ray.tMax, node.lower, node.upper) == std::numeric_limits<float>::infinity())
+            continue;
+        if (node.count > 0)
+        {
+            for (unsigned int i = node.offset; i < node.offset + node.count; i++)
+                if (intersectTriangle(ray, i, hit))
+                    return true;
+        }
+        else
+        {
+            stack[depth++] = node.offset;
+            stack[depth++] = &node - &nodes[0] + 1;
+        }
+    }
+    return false;
+}
+
+void BVH::intersect(const Ray* rays, RayHit* hits, unsigned int count) const
+{
+    for (unsigned int start = 0; start < count; start += BVH_PACKET)
+    {
+        unsigned int n = std::min(BVH_PACKET, count - start);
+        const Ray* packetRays = rays + start;
+        RayHit* packetHits = hits + start;
+        RayPacket packet;
+        for (unsigned int r = 0; r < BVH_PACKET; r++)
+        {
+            const Ray& ray = packetRays[r < n ? r : 0];
+            glm::vec3 invDirection = 1.0f / ray.direction;
+            for (int c = 0; c < 3; c++)
+            {
+                packet.origin[c][r] = ray.origin[c];
+                packet.invDirection[c][r] = invDirection[c];
+            }
+            packet.tMax[r] = r < n ? ray.tMax : -1.0f;
+            if (r < n)
+                packetHits[r] = RayHit();
+        }
+        if (nodes.empty())
+            continue;
+
+        unsigned int local[BVH_STACK];
+        std::vector<unsigned int> heap;
+        unsigned int* stack = traversalStack(local, heap);
+        unsigned int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            const BVHNode& node = nodes[stack[--depth]];
+            // the rays still entering this node before their nearest hit so far
+            unsigned int active = packetBoxMask(packet, node.lower, node.upper);
+            if (active == 0)
+                continue;
+            if (node.count > 0)
+            {
+                for (unsigned int m = active; m != 0; m &= m - 1)
+                {
+                    unsigned int r = __builtin_ctz(m);
+                    for (unsigned int i = node.offset; i < node.offset + node.count; i++)
+                        intersectTriangle(packetRays[r], i, packetHits[r]);
+                    packet.tMax[r] = std::min(packetRays[r].tMax, packetHits[r].t);
+                }
+            }
+            else
+            {
+                // front to back for the first active ray, which the rest of a coherent packet follows
+                unsigned int r = __builtin_ctz(active);
+                glm::vec3 origin(packet.origin[0][r], packet.origin[1][r], packet.origin[2][r]);
+                glm::vec3 invDirection(packet.invDirection[0][r], packet.invDirection[1][r], packet.invDirection[2][r]);
+                unsigned int left = &node - &nodes[0] + 1, right = node.offset;
+                float tLeft = rayBoxEntry(origin, invDirection, packet.tMax[r], nodes[left].lower, nodes[left].upper);
+                float tRight = rayBoxEntry(origin, invDirection, packet.tMax[r], nodes[right].lower, nodes[right].upper);
+                stack[depth++] = tRight < tLeft ? left : right;
+                stack[depth++] = tRight < tLeft ? right : left;
+            }
+        }
+    }
+}
+
+DynamicBVH::~DynamicBVH()
+{
+    if (builder.joinable())
+        builder.join();
+}
+
+bool DynamicBVH::build(const Mesh& mesh, ThreadPool* pool)
+{
+    if (builder.joinable())
+        builder.join();
+    building = false;
+    nextReady = false;
+    current.build(mesh, pool);
+    builtCost = current.sahCost();
+    return !current.nodes.empty();
+}
+
+float DynamicBVH::costRatio() const
+{
+    return builtCost > 0.0f ? current.sahCost() / builtCost : 1.0f;
+}
+
+void DynamicBVH::update(const VertexSoA& vertices, ThreadPool* pool)
+{
+    // 1. a finished rebuild takes over (catching up with the vertices that moved meanwhile),
+    // otherwise the current tree is refitted
+    if (building && nextReady)
+    {
+        builder.join();
+        building = false;
+        nextReady = false;
+        std::swap(current, next);
+        builtCost = nextCost;
+        rebuilds++;
+    }
+    if (!current.refit(vertices, pool))
+        return;
+
+    // 2. rebuild from a snapshot of the corners, on a thread of its own (its own pool as well,
+    // since a pool runs one job at a time)
+    if (!building && costRatio() > rebuildRatio)
+    {
+        std::vector<glm::vec3> triangleCorners(current.corners.size());
+        std::vector<unsigned int> vertexIds(current.corners.size());
+        for (std::size_t slot = 0; slot < current.triangleIds.size(); slot++)
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                triangleCorners[current.triangleIds[slot] * 3 + k] = current.corners[slot * 3 + k];
+                vertexIds[current.triangleIds[slot] * 3 + k] = current.cornerVertices[slot * 3 + k];
+            }
+        building = true;
+        builder = std::thread([this, triangleCorners, vertexIds]()
+        {
+            ThreadPool serial(1);
+            next.build(triangleCorners, &serial, &vertexIds);
+            nextCost = next.sahCost();
+            nextReady = true;
+        });
+    }
+}
+
+#endif
@@ -1,18 +1,31 @@
 #version 450 core
 in vec3 FragPos;
 flat in vec3 Normal;
+flat in float Occlusion;
 out vec4 FragColor;
 
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-uniform vec3 objectColor;
-uniform vec3 lightColor;
+// per-frame block shared by every program (see uniforms.hpp)
+layout (std140, binding = 0) uniform Frame
+{
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    vec3 lightColor;
+    vec3 viewPos;
+};
+// per-object block, the normal matrix is computed once on the CPU
+layout (std140, binding = 1) uniform Object
+{
+    mat4 model;
+    mat3 normalMatrix;
+    vec3 objectColor;
+};
 
 void main()
 {
     // ambient component calculation
     float ambientStrength = 0.1;
-    vec3 ambient = ambientStrength * lightColor;
+    vec3 ambient = ambientStrength * Occlusion * lightColor;
 
     // diffuse component calculation
     vec3 norm = normalize(Normal);
@@ -1,17 +1,33 @@
 #version 450 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in float aOcclusion; // baked ambient occlusion, 1 when the mesh has none
 
 out vec3 FragPos;
 flat out vec3 Normal;
+flat out float Occlusion;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-frame block shared by every program (see uniforms.hpp)
+layout (std140, binding = 0) uniform Frame
+{
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    vec3 lightColor;
+    vec3 viewPos;
+};
+// per-object block, the normal matrix is computed once on the CPU
+layout (std140, binding = 1) uniform Object
+{
+    mat4 model;
+    mat3 normalMatrix;
+    vec3 objectColor;
+};
 
 void main()
 {
     gl_Position = projection * view * model * vec4(aPos, 1.0);
     FragPos = vec3(model * vec4(aPos, 1.0)); // fragment position in world space
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = normalMatrix * aNormal;
+    Occlusion = aOcclusion;
 }
\ No newline at end of file
@@ -1,26 +1,36 @@
 #version 450 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in float aOcclusion; // baked ambient occlusion, 1 when the mesh has none
 
 out vec4 Color;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-uniform vec3 objectColor;
-uniform vec3 lightColor;
+// per-frame block shared by every program (see uniforms.hpp)
+layout (std140, binding = 0) uniform Frame
+{
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    vec3 lightColor;
+    vec3 viewPos;
+};
+// per-object block, the normal matrix is computed once on the CPU
+layout (std140, binding = 1) uniform Object
+{
+    mat4 model;
+    mat3 normalMatrix;
+    vec3 objectColor;
+};
 
 void main()
 {
     gl_Position = projection * view * model * vec4(aPos, 1.0);
     vec3 FragPos = vec3(model * vec4(aPos, 1.0)); // fragment position in world space
-    vec3 Normal = mat3(transpose(inverse(model))) * aNormal;
+    vec3 Normal = normalMatrix * aNormal;
 
     // ambient component calculation
     float ambientStrength = 0.1;
-    vec3 ambient = ambientStrength * lightColor;
+    vec3 ambient = ambientStrength * aOcclusion * lightColor;
 
     // diffuse component calculation
     vec3 norm = normalize(Normal);
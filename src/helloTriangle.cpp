@@ -9,14 +9,30 @@
 
 #include "shader.hpp"
 #include "mesh.hpp"
+#include "progressive.hpp"
+#include "iosystem.hpp"
+#include "archive.hpp"
+#include "pack.hpp"
+#include "selector.hpp"
+#include "batch.hpp"
+#include "morph.hpp"
+#include "occlusion.hpp"
+#include "bvh.hpp"
+#include "ambient.hpp"
+#include "uniforms.hpp"
 
 #include <string>
 #include <fstream>
 #include <streambuf>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <cmath>
 
 #include <iostream>
 
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow* window);
 
@@ -31,9 +47,8 @@ glm::vec3 viewPos(0.0f, 0.0f, -3.0f);
 
 // transform
 glm::mat4 model;
-glm::mat4 rotation;
-glm::mat4 translation;
-glm::mat4 scale;
+// the object's translation, rotation and scale (versioned, see TransformState)
+TransformState objectTransform;
 glm::vec3 scaleSize;
 
 // dummy transform to act as placeholder uniform for cpu calculations
@@ -44,11 +59,37 @@ double rotatStrength;
 double transStrength;
 double scaleStrength;
 
-// calculation method toggle boolean
+// calculation method toggle boolean, and whether it is picked from measurements
 bool gpuCalc;
+bool autoCalc;
+TransformSelector transformSelector;
 
-int main()
+// progressive mesh refinement target (triangles) and per-frame budgets
+unsigned int progressiveTarget;
+const double progressiveBudgetMs = 2.0;
+const std::size_t progressiveBytesPerFrame = 256 * 1024;
+
+// hemisphere rays per vertex of the ambient occlusion bake
+const unsigned int ambientRays = 64;
+
+// morph target weights animate while this is on; when the model has no targets, why not
+bool morphAnimate;
+std::string morphUnavailable;
+
+// scene objects hidden behind the occluders are not drawn while this is on
+bool occlusionCulling = true;
+
+// a left click asks for a pick at the cursor, answered in the render loop
+bool pickRequested = false;
+double pickX, pickY;
+
+int main(int argc, char** argv)
 {
+    // --progressive shows the model from its progressive stream (see below)
+    bool progressiveRequested = false;
+    for (int i = 1; i < argc; i++)
+        progressiveRequested = progressiveRequested || std::string(argv[i]) == "--progressive";
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -65,7 +106,7 @@ int main()
     std::string objFile;
     std::string lightingModel;
 
-    std::cout << "\nPlease type in .obj filename or type 'DEFAULT' (loads shark.obj).\nFile name: ";
+    std::cout << "\nPlease type in .obj filename or type 'DEFAULT' (loads shark.obj) or 'SCENE' (a batched grid of small models).\nFile name: ";
     std::cin >> objFile;
 
     while (true)
@@ -98,12 +139,23 @@ int main()
 
     if (objFile == "DEFAULT")
         objFile = "shark.obj";
+    bool scene = objFile == "SCENE";
     
     std::size_t extension = objFile.find(".obj");
-    if (extension == std::string::npos)
+    if (extension == std::string::npos && !scene)
         objFile.append(".obj");
 
-    std::string objPath = "../data/" + objFile;
+    // progressive stream for the same model (written after a full load)
+    std::string pmFile = objFile.substr(0, objFile.rfind(".obj")) + ".pm";
+    std::string pmPath = "../data/" + pmFile;
+
+    // assets are read from ../data/assets.zip when it exists, otherwise from the mapped loose files
+    MMapIOSystem looseData("../data/");
+    ZipIOSystem archiveData("../data/assets.zip");
+    IOSystem* dataIO = archiveData.valid() ? (IOSystem*)&archiveData : (IOSystem*)&looseData;
+    // meshes compiled by tools/packassets skip parsing altogether
+    AssetPack pack("../data/assets.pack");
+    FileIOSystem shaderIO("../src/");
 
     // glfw window creation
     // --------------------
@@ -117,6 +169,7 @@ int main()
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
 
     // tell GLFW to capture our mouse (for use with scaling transform)
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
@@ -124,18 +177,244 @@ int main()
     // glew: load all OpenGL function pointers
     glewInit();
 
-    // build our shader program
-    std::string vs = "../src/" + lightingModel + ".vs";
-    std::string fs = "../src/" + lightingModel + ".fs";
-    Shader ourShader(vs.c_str(), fs.c_str());
+    // build our shader program and the light's (restored from the binary cache when this driver
+    // linked them before); both are only issued here and finished while the model loads
+    bool parallelCompile = enableParallelShaderCompile();
+    std::string vs = lightingModel + ".vs";
+    std::string fs = lightingModel + ".fs";
+    std::string programBinary = "../data/" + lightingModel + ".program";
+    auto shaderStart = std::chrono::steady_clock::now();
+    Shader ourShader(vs.c_str(), fs.c_str(), &shaderIO, programBinary.c_str(), true);
+    Shader lightShader("light.vs", "light.fs", &shaderIO, "../data/light.program", true);
+    Shader* const shaders[] = { &ourShader, &lightShader };
+    double shaderSeconds = -1.0;
+    // finishes the programs the driver is done with (all of them when waiting), and notes when
+    // the last one was
+    auto finishShaders = [&](bool wait)
+    {
+        bool done = true;
+        for (Shader* program : shaders)
+        {
+            if (wait || program->ready())
+                program->finish();
+            else
+                done = false;
+        }
+        if (done && shaderSeconds < 0.0)
+            shaderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - shaderStart).count();
+    };
     // build our mesh object
-    Mesh ourMesh(objPath.c_str());
-    ourMesh.load();
+    // with --progressive and a stream built from the current .obj, put its base mesh on screen
+    // right away and refine while rendering; otherwise load the whole .obj, and write the
+    // stream when there is none built from this version of the model
+    Mesh ourMesh;
+    ProgressiveStream pmStream;
+    ProgressiveRenderer pmRenderer;
+    std::thread pmWriter;
+    uint64_t sourceKey = scene ? 0 : progressiveKey(objFile.c_str(), dataIO);
+    bool pmCurrent = false;
+    if (sourceKey != 0)
+    {
+        ProgressiveStream existing;
+        if (existing.open(pmFile.c_str(), dataIO))
+        {
+            while (!existing.headerReady && !existing.complete)
+                existing.pump(progressiveBytesPerFrame);
+            pmCurrent = existing.headerReady && existing.mesh.sourceKey == sourceKey;
+        }
+    }
+    bool progressive = false;
+    if (progressiveRequested && scene)
+        std::cout << "--progressive: the scene has no progressive stream, loading it in full" << std::endl;
+    else if (progressiveRequested && !pmCurrent)
+        std::cout << "--progressive: no stream built from the current " << objFile << " yet, loading it in full (the stream is written for the next launch)" << std::endl;
+    else if (progressiveRequested && pmStream.open(pmFile.c_str(), dataIO))
+    {
+        while (!pmStream.baseReady && !pmStream.complete)
+            pmStream.pump(progressiveBytesPerFrame);
+        progressive = pmStream.baseReady;
+    }
+    if (progressive)
+    {
+        std::cout << "Progressive stream: morph targets, picking, ambient occlusion and the CPU transform paths need the full load (run without --progressive)" << std::endl;
+        pmRenderer.load(pmStream.mesh);
+        ourMesh.largestVertex = pmStream.mesh.largestVertex;
+        progressiveTarget = pmStream.mesh.faceCount;
+    }
+    // only parse the attributes the selected shader reads (decided by the shading model, as
+    // the program may still be linking; the depth shader is the only one without normals)
+    unsigned int attributes = ATTRIB_POSITION;
+    if (lightingModel != "depth")
+        attributes |= ATTRIB_NORMAL;
+    auto loadModel = [&](const std::string& name, Mesh& mesh)
+    {
+        if (!pack.valid() || !pack.loadMesh(name.c_str(), mesh))
+            mesh = Mesh(name.c_str(), attributes, dataIO);
+    };
+    // depth mode only reads aPos, so it only needs the packed position stream
+    unsigned int meshStreams = lightingModel == "depth" ? STREAM_POSITION : STREAM_INTERLEAVED;
+
+    // the scene: a grid of small models pre-transformed into one static batch per model
+    // (each model is its own material), so hundreds of objects take a handful of draws
+    StaticBatch sceneBatch;
+    Mesh sceneOccluder;
+    glm::mat4 occluderPlacement(1.0f);
+    OccluderMesh occluderMesh;
+    OcclusionCuller culler;
+    std::vector<char> sceneVisible;
+    // the hierarchy for picking in the scene, in batch space, and the object behind each of its
+    // triangles (the castle is the one past the batched objects)
+    BVH sceneBVH;
+    std::vector<unsigned int> sceneTriangleObjects;
+    const glm::vec3 sceneColors[] = { glm::vec3(1.0f, 0.5f, 0.5f), glm::vec3(0.5f, 0.8f, 1.0f), glm::vec3(0.6f, 1.0f, 0.5f) };
+    if (scene)
+    {
+        const char* sceneModels[] = { "pawn.obj", "cube.obj", "flowers.obj" };
+        std::vector<Mesh> sceneMeshes(3);
+        for (int m = 0; m < 3; m++)
+        {
+            loadModel(sceneModels[m], sceneMeshes[m]);
+            sceneMeshes[m].buildIndices(false);
+        }
+        const int gridSize = 16;
+        for (int i = 0; i < gridSize * gridSize; i++)
+        {
+            int m = i % 3;
+            float size = 0.4f / std::max(glm::length(sceneMeshes[m].largestVertex), 1e-6f);
+            glm::mat4 placement = glm::translate(glm::mat4(1.0f), glm::vec3(i % gridSize - gridSize / 2.0f + 0.5f, i / gridSize - gridSize / 2.0f + 0.5f, 0.0f));
+            placement = glm::rotate(placement, 0.7f * i, glm::vec3(0.0f, 1.0f, 0.0f));
+            placement = glm::scale(placement, glm::vec3(size));
+            sceneBatch.add(&sceneMeshes[m], placement, 0, m);
+        }
+        sceneBatch.build();
+        sceneBatch.load(meshStreams);
+        ourMesh.largestVertex = glm::max(glm::abs(sceneBatch.lower), glm::abs(sceneBatch.upper));
+        std::cout << sceneBatch.objects.size() << " objects batched into " << sceneBatch.groups.size() << " draws" << std::endl;
+
+        // a castle standing in front of the lower half of the grid, drawn as usual and
+        // rasterized at a thousand triangles into the culler's depth buffer
+        loadModel("castle.obj", sceneOccluder);
+        sceneOccluder.load(meshStreams);
+        float castleSize = 8.0f / std::max(glm::length(sceneOccluder.largestVertex), 1e-6f);
+        occluderPlacement = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -5.0f, 3.5f));
+        occluderPlacement = glm::scale(occluderPlacement, glm::vec3(castleSize));
+        occluderMesh = OcclusionCuller::makeOccluder(sceneOccluder, 1024);
+        sceneVisible.assign(sceneBatch.objects.size(), 1);
+
+        std::vector<glm::vec3> sceneCorners;
+        for (const BatchGroup& group : sceneBatch.groups)
+        {
+            meshTriangleCorners(group.geometry, sceneCorners);
+            for (unsigned int i : group.objects)
+                sceneTriangleObjects.insert(sceneTriangleObjects.end(), sceneBatch.ranges[i].indexCount / 3, i);
+        }
+        std::size_t castleFirst = sceneCorners.size();
+        meshTriangleCorners(sceneOccluder, sceneCorners);
+        for (std::size_t c = castleFirst; c < sceneCorners.size(); c++)
+            sceneCorners[c] = glm::vec3(occluderPlacement * glm::vec4(sceneCorners[c], 1.0f));
+        sceneTriangleObjects.resize(sceneCorners.size() / 3, sceneBatch.objects.size());
+        auto start = std::chrono::steady_clock::now();
+        sceneBVH.build(sceneCorners);
+        std::cout << "BVH: " << sceneCorners.size() / 3 << " triangles, " << sceneBVH.nodes.size() << " nodes, built in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+        std::cout << "castle.obj occludes with " << occluderMesh.faces.size() << " triangles (C toggles occlusion culling)" << std::endl;
+    }
+    // blend shapes in data/: base models and the models of the same topology used as their targets
+    const char* morphModels[][2] = { { "head.obj", "head_chord.obj" } };
+    MorphSet morph;
+    std::vector<float> morphWeights;
+    DynamicBVH meshBVH;
+    if (scene)
+        morphUnavailable = "the scene has no morph targets";
+    else if (progressive)
+        morphUnavailable = "morph targets need the full load (run without --progressive)";
+    if (!scene && !progressive)
+    {
+        // targets are matched through the parsed faces, so a morph base is never taken from the pack
+        bool morphBase = false;
+        for (const auto& entry : morphModels)
+            morphBase = morphBase || objFile == entry[0];
+        // parse on a worker thread and link the programs on this one meanwhile, each as soon as
+        // the driver reports it done (or waiting for it right away when the driver cannot say)
+        std::future<void> parse = std::async(std::launch::async, [&]()
+        {
+            if (morphBase)
+                ourMesh = Mesh(objFile.c_str(), attributes, dataIO);
+            else
+                loadModel(objFile, ourMesh);
+        });
+        while (parse.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready)
+            finishShaders(false);
+        parse.get();
+        ourMesh.load(meshStreams);
+        if (!morphBase)
+            morphUnavailable = objFile + " has no morph targets";
+        else if (!morph.setBase(ourMesh))
+            morphUnavailable = objFile + " could not be set up as a morph base";
+        else
+        {
+            for (const auto& entry : morphModels)
+            {
+                if (objFile != entry[0])
+                    continue;
+                Mesh target(entry[1], attributes, dataIO);
+                morph.addTarget(target, entry[1]);
+            }
+            morphWeights.assign(morph.targets.size(), 0.0f);
+            if (morph.targets.empty())
+                morphUnavailable = "none of the morph targets of " + objFile + " could be loaded";
+            else
+                std::cout << morph.targets.size() << " morph targets, " << morph.deltaCount() << " stored deltas (M animates the weights)" << std::endl;
+        }
+        if (morphBase && !morphUnavailable.empty())
+            std::cout << "Morphing is not available: " << morphUnavailable << std::endl;
+        if (!pmCurrent && sourceKey != 0)
+        {
+            pmWriter = std::thread([ourMesh, pmPath, sourceKey]()
+            {
+                ProgressiveMesh pm;
+                pm.build(ourMesh);
+                pm.sourceKey = sourceKey;
+                pm.write(pmPath.c_str());
+            });
+        }
 
-    // build the light shader
-    Shader lightShader("../src/light.vs", "../src/light.fs");
+        // the hierarchy for mouse picking, in the model's own space (refitted while morphing)
+        auto start = std::chrono::steady_clock::now();
+        if (meshBVH.build(ourMesh))
+            std::cout << "BVH: " << meshBVH.bvh().corners.size() / 3 << " triangles, " << meshBVH.bvh().nodes.size() << " nodes, built in "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+
+        // ambient occlusion for the lit shading models, baked against the same hierarchy on the
+        // first launch and read from the cache next to the model after that (every full load
+        // reads it; the progressive stream has no per-vertex occlusion)
+        if (ourMesh.stride() == 2)
+        {
+            std::string aoPath = "../data/" + objFile.substr(0, objFile.rfind(".obj")) + ".ao";
+            if (readAmbientOcclusion(ourMesh, aoPath.c_str(), ambientRays))
+                std::cout << "Ambient occlusion: read from " << aoPath << std::endl;
+            else
+            {
+                start = std::chrono::steady_clock::now();
+                if (bakeAmbientOcclusion(ourMesh, ambientRays, 0.0f, &meshBVH.bvh()))
+                {
+                    std::cout << "Ambient occlusion: " << ambientRays << " rays per vertex baked in "
+                              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms ("
+                              << defaultThreadPool()->size() << " threads)" << std::endl;
+                    writeAmbientOcclusion(ourMesh, aoPath.c_str(), ambientRays);
+                }
+            }
+        }
+    }
+
+    // whatever the driver has not finished yet is waited for here
+    finishShaders(true);
+    std::cout << "Shaders " << (ourShader.cached && lightShader.cached ? "restored" : "compiled") << ", ready " << shaderSeconds * 1000.0
+              << " ms after being issued" << (parallelCompile ? " (parallel compile)" : "") << std::endl;
     // build and render light source cube
-    Mesh lightCube("../data/cube.obj");
+    Mesh lightCube;
+    if (!pack.valid() || !pack.loadMesh("cube.obj", lightCube))
+        lightCube = Mesh("cube.obj", ATTRIB_POSITION | ATTRIB_NORMAL, dataIO);
     lightCube.load();
 
     // print out control instructions to the console
@@ -148,13 +427,41 @@ int main()
     std::cout << "yaw -> Q and E" << std::endl;
     std::cout << "Translation: arrow keys" << std::endl;
     std::cout << "Scale: mouse scroll wheel / I and O" << std::endl;
-    std::cout << "Toggle between CPU and GPU calc: T" << std::endl;
+    std::cout << "Cycle transform calc (automatic, GPU, CPU): T" << std::endl;
+    if (progressive)
+        std::cout << "Progressive detail: , and ." << std::endl;
+    // what a click is traced against
+    const BVH& pickBVH = scene ? sceneBVH : meshBVH.bvh();
+    if (!pickBVH.nodes.empty())
+        std::cout << "Pick a point on the model: left click" << std::endl;
 
     // uncomment this call to draw in wireframe polygons.
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
     // Enable z-buffer for depth checking
     glEnable(GL_DEPTH_TEST);
+    // meshes without baked ambient occlusion (and the batches) read a fully open value
+    glVertexAttrib1f(2, 1.0f);
+
+    // the uniform blocks all programs share: one per frame, one per object drawn
+    UniformBuffer<FrameUniforms> frameBlock;
+    UniformBuffer<ObjectUniforms> objectBlock, lightBlock;
+    frameBlock.create();
+    frameBlock.bind(FRAME_BLOCK_BINDING);
+    objectBlock.create();
+    lightBlock.create();
+    // the scene's objects: one block per batch group, then the occluder's
+    UniformArrayBuffer<ObjectUniforms> sceneBlocks;
+    std::vector<ObjectUniforms> sceneObjects;
+    if (scene)
+        sceneBlocks.create(sceneBatch.groups.size() + 1);
+    // the blocks the linker reports must have the size of the structs uploaded into them
+    for (const Shader* program : { &ourShader, &lightShader })
+    {
+        int frameSize = program->blockSize("Frame"), objectSize = program->blockSize("Object");
+        if ((frameSize >= 0 && frameSize != (int)sizeof(FrameUniforms)) || (objectSize >= 0 && objectSize != (int)sizeof(ObjectUniforms)))
+            std::cout << "ERROR::SHADER::UNIFORM_BLOCK_LAYOUT_MISMATCH" << std::endl;
+    }
 
     // set value of dummy transform to identity matrix
     dummyTransform = glm::mat4(1.0f);
@@ -163,12 +470,10 @@ int main()
 
     // intialize transformation matrices as identity matrices
     model = glm::mat4(1.0f);
-    rotation = glm::mat4(1.0f);
-    translation = glm::mat4(1.0f);
-    scale = glm::mat4(1.0f);
+    objectTransform.reset();
     // initialize scale matrix by using mesh data
     double normalScale = 1.0 / glm::length(ourMesh.largestVertex);
-    scale = glm::scale(scale, glm::vec3(normalScale));
+    objectTransform.scale(glm::vec3(normalScale));
     // initialize transformation control setting
     rotatStrength = 0.02;
     transStrength = 0.0001;
@@ -177,13 +482,34 @@ int main()
     // set some new values for the depth test if selected
     if (lightingModel == "depth")
     {
-        scale = glm::scale(scale, glm::vec3(20.0));
-        translation = glm::translate(translation, glm::vec3(0.0, 0.0, -50.0));
+        objectTransform.scale(glm::vec3(20.0));
+        objectTransform.translate(glm::vec3(0.0, 0.0, -50.0));
         transStrength = 0.005;
     }
 
-    // define our initial calculation method to be by using the GPU
+    // define our initial calculation method to be by using the GPU, until the selector has
+    // measured both paths
     gpuCalc = true;
+    autoCalc = !progressive && !scene;
+    bool cpuTransformed = false;
+    transformSelector.init();
+
+    // transformed vertices per second of either path, printed once a second: the CPU path is
+    // timed around applyTransform (transform into mapped memory, including fence waits), the
+    // GPU path with a timer query around the draw (which includes rasterization, so it is a
+    // lower bound)
+    double transformSeconds = 0.0, transformedVertices = 0.0;
+    double reportTime = glfwGetTime();
+    double vertexCount = ourMesh.indexedVertices.size() / ourMesh.stride();
+    // time spent blending the morph targets, printed with the throughput
+    double morphSeconds = 0.0;
+    unsigned int morphFrames = 0;
+    // time spent refitting the picking hierarchy to the blend
+    double refitSeconds = 0.0;
+    bool morphed = false;
+    // time spent culling the scene and the draws it rejected, printed with the throughput
+    double cullSeconds = 0.0;
+    unsigned int cullFrames = 0, culledObjects = 0;
 
     // render loop
     // -----------
@@ -200,14 +526,10 @@ int main()
 
         // enable shader
         ourShader.use();
-        ourShader.setVec3("objectColor", 1.0f, 0.5f, 0.5f);
-        ourShader.setVec3("lightColor", 1.0f, 1.0f, 1.0f);
-        ourShader.setVec3("lightPos", lightPos);
-        ourShader.setVec3("viewPos", viewPos);
 
         // calculate our model transformation
         // ----------------------------------
-        model = translation * rotation * scale;
+        model = objectTransform.model();
 
         glm::mat4 view = glm::mat4(1.0f);
         // note that we're translating the scene in the reverse direction of where we want to move
@@ -216,20 +538,190 @@ int main()
         glm::mat4 projection = glm::mat4(1.0f);
         projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
     
+        // pick: the ray under the cursor, from the near to the far plane, taken into model space
+        // (t then still measures along it) and traced through the hierarchy
+        if (pickRequested && pickBVH.nodes.empty())
+            std::cout << "Picking is not available: " << (progressive ? "the progressive stream has no hierarchy (run without --progressive)" : "the model has no triangles to pick") << std::endl;
+        else if (pickRequested)
+        {
+            int windowWidth, windowHeight;
+            glfwGetWindowSize(window, &windowWidth, &windowHeight);
+            glm::vec2 ndc(2.0 * pickX / std::max(windowWidth, 1) - 1.0, 1.0 - 2.0 * pickY / std::max(windowHeight, 1));
+            glm::mat4 toModel = glm::inverse(projection * view * model);
+            glm::vec4 nearPoint = toModel * glm::vec4(ndc, -1.0f, 1.0f);
+            glm::vec4 farPoint = toModel * glm::vec4(ndc, 1.0f, 1.0f);
+            glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+            Ray ray(origin, glm::vec3(farPoint) / farPoint.w - origin, 1.0f);
+
+            auto start = std::chrono::steady_clock::now();
+            RayHit hit;
+            bool found = pickBVH.intersect(ray, hit);
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            if (found)
+            {
+                glm::vec3 world = glm::vec3(model * glm::vec4(ray.origin + hit.t * ray.direction, 1.0f));
+                std::cout << "Picked triangle " << hit.triangle;
+                if (scene && sceneTriangleObjects[hit.triangle] < sceneBatch.objects.size())
+                    std::cout << " of object " << sceneTriangleObjects[hit.triangle];
+                else if (scene)
+                    std::cout << " of the castle";
+                std::cout << " at (" << world.x << ", " << world.y << ", " << world.z << ") in " << us << " us" << std::endl;
+            }
+            else
+                std::cout << "Picked nothing (" << us << " us)" << std::endl;
+        }
+        pickRequested = false;
+
 
         // apply our transformation
         // ------------------------
-        int modelLoc = glGetUniformLocation(ourShader.ID, "model");
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-        int viewLoc = glGetUniformLocation(ourShader.ID, "view");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        // the CPU path bakes the model transform into the vertex buffer and hands the shader
+        // an identity model matrix (the progressive renderer always transforms on the GPU)
+        if (autoCalc)
+            gpuCalc = transformSelector.beginFrame(glfwGetTime()) == TRANSFORM_GPU;
+        bool cpuTransform = !gpuCalc && !progressive && !scene;
+
+        // the morph blend is streamed like the CPU transform: with the model transform baked in
+        // on the CPU path, untransformed on the GPU path
+        bool morphing = morphAnimate && !morph.targets.empty();
+        if (morphing)
+        {
+            double time = glfwGetTime();
+            for (unsigned int t = 0; t < morphWeights.size(); t++)
+                morphWeights[t] = (float)(0.5 + 0.5 * std::sin(time * (1.0 + 0.3 * t)));
+            auto start = std::chrono::steady_clock::now();
+            morph.apply(ourMesh, morphWeights, cpuTransform ? model : dummyTransform);
+            morphSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            morphFrames++;
+            // picking follows the blend (the transform source holds it untransformed)
+            start = std::chrono::steady_clock::now();
+            meshBVH.update(ourMesh.transformSource);
+            refitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        else if (morphed)
+        {
+            // back to the base shape
+            std::fill(morphWeights.begin(), morphWeights.end(), 0.0f);
+            morph.evaluate(morphWeights, ourMesh.transformSource);
+            meshBVH.update(ourMesh.transformSource);
+            ourMesh.resetTransform();
+        }
+        morphed = morphing;
 
-        int projectionLoc = glGetUniformLocation(ourShader.ID, "projection");
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        if (cpuTransform && !morphing)
+        {
+            // nothing is transformed or written while the object does not move
+            auto start = std::chrono::steady_clock::now();
+            bool transformed = ourMesh.applyTransform(objectTransform);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (autoCalc)
+                transformSelector.addCpuTime(seconds * 1000.0);
+            if (transformed)
+            {
+                transformSeconds += seconds;
+                transformedVertices += vertexCount;
+            }
+        }
+        else if (cpuTransformed && !morphing)
+            ourMesh.resetTransform();
+        cpuTransformed = cpuTransform;
+
+        // camera and light once for every program, then the object's blocks (the uploads are
+        // skipped while nothing changes)
+        FrameUniforms frame;
+        frame.view = view;
+        frame.projection = projection;
+        frame.lightPos = glm::vec4(lightPos, 1.0f);
+        frame.lightColor = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+        frame.viewPos = glm::vec4(viewPos, 1.0f);
+        frameBlock.upload(frame);
+        if (scene)
+        {
+            sceneObjects.clear();
+            for (const BatchGroup& group : sceneBatch.groups)
+                sceneObjects.push_back(ObjectUniforms(model, sceneColors[group.material % 3]));
+            sceneObjects.push_back(ObjectUniforms(model * occluderPlacement, glm::vec3(0.7f, 0.7f, 0.7f)));
+            sceneBlocks.upload(sceneObjects);
+        }
+        else
+        {
+            objectBlock.bind(OBJECT_BLOCK_BINDING);
+            objectBlock.upload(ObjectUniforms(cpuTransform ? dummyTransform : model, glm::vec3(1.0f, 0.5f, 0.5f)));
+        }
 
         // render object
-        ourMesh.render();
+        if (scene)
+        {
+            // test every object's bounds against the occluder's depth before drawing the batches
+            if (occlusionCulling)
+            {
+                auto start = std::chrono::steady_clock::now();
+                glm::mat4 viewProjection = projection * view;
+                culler.clear();
+                culler.rasterize(occluderMesh, viewProjection * model * occluderPlacement);
+                culler.finish();
+                for (std::size_t i = 0; i < sceneVisible.size(); i++)
+                {
+                    sceneVisible[i] = culler.visible(sceneBatch.ranges[i].lower, sceneBatch.ranges[i].upper, viewProjection * model);
+                    culledObjects += !sceneVisible[i];
+                }
+                cullSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                cullFrames++;
+            }
+            for (unsigned int g = 0; g < sceneBatch.groups.size(); g++)
+            {
+                sceneBlocks.bindEntry(OBJECT_BLOCK_BINDING, g);
+                sceneBatch.render(g, occlusionCulling ? &sceneVisible : NULL);
+            }
+            sceneBlocks.bindEntry(OBJECT_BLOCK_BINDING, sceneBatch.groups.size());
+            sceneOccluder.render();
+        }
+        else if (progressive)
+        {
+            // stream in more splits and refine towards the target within this frame's budget
+            pmStream.pump(progressiveBytesPerFrame);
+            pmRenderer.targetTriangles = progressiveTarget;
+            pmRenderer.refine(pmStream.mesh, progressiveBudgetMs);
+            pmRenderer.render();
+        }
+        else
+        {
+            transformSelector.beginDraw();
+            ourMesh.render();
+            transformSelector.endDraw();
+        }
+
+        // collect the GPU timings once they are available (a frame or two later)
+        TransformPath timedPath;
+        double gpuMs;
+        while (transformSelector.collect(timedPath, gpuMs))
+        {
+            if (timedPath == TRANSFORM_GPU)
+            {
+                transformSeconds += gpuMs * 1e-3;
+                transformedVertices += vertexCount;
+            }
+        }
+        if (glfwGetTime() - reportTime >= 1.0)
+        {
+            if (transformSeconds > 0.0 && !progressive)
+                std::cout << (gpuCalc ? "GPU" : std::string("CPU (") + transformPath() + ", " + std::to_string(defaultThreadPool()->size()) + " threads)") << " transform: "
+                          << transformedVertices / transformSeconds / 1e6 << " million vertices/s" << std::endl;
+            if (morphFrames > 0)
+                std::cout << "Morph blend: " << morphSeconds * 1000.0 / morphFrames << " ms per frame (" << morph.targets.size()
+                          << " weights, " << morph.deltaCount() << " deltas, " << transformPath() << "), BVH refit: "
+                          << refitSeconds * 1000.0 / morphFrames << " ms (SAH cost " << meshBVH.costRatio() << "x the last build's, "
+                          << meshBVH.rebuilds << " rebuilds)" << std::endl;
+            if (cullFrames > 0)
+                std::cout << "Occlusion culling: " << culledObjects * 100.0 / (cullFrames * sceneVisible.size()) << "% of "
+                          << sceneVisible.size() << " objects rejected, " << cullSeconds * 1000.0 / cullFrames << " ms per frame" << std::endl;
+            morphSeconds = refitSeconds = 0.0;
+            morphFrames = 0;
+            cullSeconds = 0.0;
+            cullFrames = culledObjects = 0;
+            transformSeconds = transformedVertices = 0.0;
+            reportTime = glfwGetTime();
+        }
 
         lightShader.use();
 
@@ -238,14 +730,9 @@ int main()
         normalScale = 1.0 / glm::length(lightCube.largestVertex);
         model = glm::scale(model, glm::vec3(normalScale));
 
-        modelLoc = glGetUniformLocation(lightShader.ID, "model");
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-        viewLoc = glGetUniformLocation(lightShader.ID, "view");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-        projectionLoc = glGetUniformLocation(lightShader.ID, "projection");
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        // the light cube keeps its own object block, which never changes
+        lightBlock.bind(OBJECT_BLOCK_BINDING);
+        lightBlock.upload(ObjectUniforms(model));
 
         lightCube.render();
 
@@ -255,6 +742,18 @@ int main()
         glfwPollEvents();
     }
 
+    transformSelector.release();
+    frameBlock.destroy();
+    objectBlock.destroy();
+    lightBlock.destroy();
+    sceneBlocks.destroy();
+    sceneBatch.unload();
+    sceneOccluder.unload();
+
+    // wait for the progressive stream to finish writing
+    if (pmWriter.joinable())
+        pmWriter.join();
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -273,39 +772,39 @@ void processInput(GLFWwindow* window)
 
     // Roll
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        rotation = glm::rotate(rotation, glm::radians((float)rotatStrength), glm::vec3(0.0, 0.0, 1.0));
+        objectTransform.rotate(glm::radians((float)rotatStrength), glm::vec3(0.0, 0.0, 1.0));
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        rotation = glm::rotate(rotation, glm::radians((float)rotatStrength), glm::vec3(0.0, 0.0, -1.0));
+        objectTransform.rotate(glm::radians((float)rotatStrength), glm::vec3(0.0, 0.0, -1.0));
     
     // Yaw
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        rotation = glm::rotate(rotation, glm::radians((float)rotatStrength), glm::vec3(0.0, -1.0, 0.0));
+        objectTransform.rotate(glm::radians((float)rotatStrength), glm::vec3(0.0, -1.0, 0.0));
     if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        rotation = glm::rotate(rotation, glm::radians((float)rotatStrength), glm::vec3(0.0, 1.0, 0.0));
+        objectTransform.rotate(glm::radians((float)rotatStrength), glm::vec3(0.0, 1.0, 0.0));
     
     // Pitch
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        rotation = glm::rotate(rotation, glm::radians((float)rotatStrength), glm::vec3(1.0, 0.0, 0.0));
+        objectTransform.rotate(glm::radians((float)rotatStrength), glm::vec3(1.0, 0.0, 0.0));
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        rotation = glm::rotate(rotation, glm::radians((float)rotatStrength), glm::vec3(-1.0, 0.0, 0.0));
+        objectTransform.rotate(glm::radians((float)rotatStrength), glm::vec3(-1.0, 0.0, 0.0));
 
     // Control keys for translation
     // ----------------------------
     if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-        translation = glm::translate(translation, glm::vec3(-transStrength, 0.0, 0.0));
+        objectTransform.translate(glm::vec3(-transStrength, 0.0, 0.0));
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-        translation = glm::translate(translation, glm::vec3(transStrength, 0.0, 0.0));
+        objectTransform.translate(glm::vec3(transStrength, 0.0, 0.0));
     if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-        translation = glm::translate(translation, glm::vec3(0.0, transStrength, 0.0));
+        objectTransform.translate(glm::vec3(0.0, transStrength, 0.0));
     if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
-        translation = glm::translate(translation, glm::vec3(0.0, -transStrength, 0.0));
+        objectTransform.translate(glm::vec3(0.0, -transStrength, 0.0));
 
     // Control keys for scaling
     // ------------------------
     if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS)
-        scale = glm::scale(scale, glm::vec3(1.0 + scaleStrength));
+        objectTransform.scale(glm::vec3(1.0 + scaleStrength));
     if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
-        scale = glm::scale(scale, glm::vec3(1.0 - scaleStrength));
+        objectTransform.scale(glm::vec3(1.0 - scaleStrength));
 
     // Change control setting speed
     // ----------------------------
@@ -322,10 +821,67 @@ void processInput(GLFWwindow* window)
         scaleStrength /= 1.5;
     }
 
-    // Calculation method toggle setting
+    // Progressive mesh detail
+    // ----------------------
+    if (glfwGetKey(window, GLFW_KEY_COMMA) == GLFW_PRESS)
+        progressiveTarget = std::max(1u, (unsigned int)(progressiveTarget * 0.98));
+    if (glfwGetKey(window, GLFW_KEY_PERIOD) == GLFW_PRESS)
+        progressiveTarget = (unsigned int)std::min(progressiveTarget * 1.02 + 1.0, 4294967295.0);
+
+    // Calculation method toggle setting (once per key press)
+    // ---------------------------
+    static bool togglePressed = false;
+    bool togglePress = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+    if (togglePress && !togglePressed)
+    {
+        // automatic -> GPU -> CPU -> automatic
+        if (autoCalc)
+        {
+            autoCalc = false;
+            gpuCalc = true;
+        }
+        else if (gpuCalc)
+            gpuCalc = false;
+        else
+        {
+            autoCalc = true;
+            transformSelector.remeasure("automatic selection turned on");
+        }
+        std::cout << "Transforming on the " << (autoCalc ? "faster path (measuring)" : gpuCalc ? "GPU" : "CPU") << std::endl;
+    }
+    togglePressed = togglePress;
+
+    // Morph target animation toggle (once per key press)
     // ---------------------------
-    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS)
-        gpuCalc = !gpuCalc;
+    static bool morphPressed = false;
+    bool morphPress = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+    if (morphPress && !morphPressed && !morphUnavailable.empty())
+        std::cout << "Morphing is not available: " << morphUnavailable << std::endl;
+    else if (morphPress && !morphPressed)
+        morphAnimate = !morphAnimate;
+    morphPressed = morphPress;
+
+    // Occlusion culling toggle (once per key press)
+    // ---------------------------
+    static bool cullPressed = false;
+    bool cullPress = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+    if (cullPress && !cullPressed)
+    {
+        occlusionCulling = !occlusionCulling;
+        std::cout << "Occlusion culling " << (occlusionCulling ? "on" : "off") << std::endl;
+    }
+    cullPressed = cullPress;
+}
+
+// Left click: pick the point under the cursor
+// ---------------------------
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    {
+        glfwGetCursorPos(window, &pickX, &pickY);
+        pickRequested = true;
+    }
 }
 
 // Detect mouse wheel scroll for scaling transformation
@@ -333,9 +889,9 @@ void processInput(GLFWwindow* window)
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
     if (yoffset > 0.0)
-        scale = glm::scale(scale, glm::vec3(1.05));
+        objectTransform.scale(glm::vec3(1.05));
     else if (yoffset < 0.0)
-        scale = glm::scale(scale, glm::vec3(0.95));    
+        objectTransform.scale(glm::vec3(0.95));    
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -345,4 +901,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     // make sure the viewport matches the new window dimensions; note that width and 
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
+    // the fragment load changed, which may tip the balance between the transform paths
+    if (autoCalc)
+        transformSelector.remeasure("window resized");
 }
\ No newline at end of file
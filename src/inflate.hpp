@@ -0,0 +1,537 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include "iosystem.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// streaming gzip/zlib/raw deflate decompressor. The compressed stream is inflated on a worker thread
+// into two alternating output chunks: while the caller parses one chunk the worker fills
+// the other, so decompression overlaps with whatever the caller does with the data.
+// (stb_image's stbi_zlib_decode_* needs the whole input and output in memory at once,
+// which rules out overlapping, hence this small pull-based inflater.)
+class InflateStream
+{
+public:
+    // the source must outlive the InflateStream; raw selects headerless deflate data (zip entries)
+    InflateStream(IOStream* source, bool raw = false, std::size_t chunkSize = 256 * 1024);
+    ~InflateStream();
+    // checks the magic bytes for a gzip member or a zlib stream (the stream position is kept)
+    static bool isCompressed(IOStream* stream);
+    // blocks until the next inflated chunk is ready (NUL terminated, the previous chunk is
+    // handed back to the worker); returns false at the end of the stream
+    bool next(const char*& data, std::size_t& size);
+    bool failed() const { return error; }
+private:
+    struct Huffman
+    {
+        std::vector<uint16_t> table; // (symbol << 4) | code length, indexed by bit-reversed code
+        int maxBits;
+    };
+    struct Abort {};
+
+    // compressed input
+    IOStream* source;
+    bool raw;
+    std::vector<unsigned char> input;
+    std::size_t inPos, inSize;
+    int overrun;
+    uint32_t bitBuf;
+    int bitCount;
+
+    // double-buffered output
+    std::size_t chunkSize;
+    std::vector<char> buffers[2];
+    std::size_t sizes[2];
+    bool ready[2];
+    int writeIdx, readIdx;
+    bool held, finished, cancelled, error;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread worker;
+
+    // sliding window for back references
+    std::vector<unsigned char> window;
+    uint32_t windowPos;
+    uint32_t crc;
+    uint32_t outTotal;
+
+    Huffman fixedLit, fixedDist;
+
+    void run();
+    bool member();
+    void blocks();
+    void block(const Huffman& lit, const Huffman& dist);
+    void dynamicTables(Huffman& lit, Huffman& dist);
+    bool build(Huffman& h, const unsigned char* lengths, int count);
+    int decode(const Huffman& h);
+
+    int nextByte();
+    uint32_t bits(int n);
+    void need(int n);
+    void emit(unsigned char byte);
+    void flush();
+    void fail(const char* what);
+    static uint32_t crc32(uint32_t crc, const char* data, std::size_t size);
+};
+
+InflateStream::InflateStream(IOStream* source, bool raw, std::size_t chunkSize)
+{
+    this->source = source;
+    this->raw = raw;
+    this->chunkSize = chunkSize;
+    inPos = inSize = 0;
+    overrun = 0;
+    bitBuf = 0;
+    bitCount = 0;
+    writeIdx = readIdx = 0;
+    held = finished = cancelled = error = false;
+    windowPos = 0;
+    crc = 0;
+    outTotal = 0;
+    input.resize(64 * 1024);
+    window.resize(32768);
+    for (int i = 0; i < 2; i++)
+    {
+        // one spare byte so every chunk can be NUL terminated for strtof and friends
+        buffers[i].resize(chunkSize + 1);
+        sizes[i] = 0;
+        ready[i] = false;
+    }
+
+    // the fixed Huffman tables from RFC 1951 3.2.6
+    unsigned char lengths[288];
+    std::memset(lengths, 8, 144);
+    std::memset(lengths + 144, 9, 112);
+    std::memset(lengths + 256, 7, 24);
+    std::memset(lengths + 280, 8, 8);
+    build(fixedLit, lengths, 288);
+    std::memset(lengths, 5, 30);
+    build(fixedDist, lengths, 30);
+
+    if (source == NULL)
+    {
+        error = finished = true;
+        return;
+    }
+    worker = std::thread(&InflateStream::run, this);
+}
+
+InflateStream::~InflateStream()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+    }
+    cond.notify_all();
+    if (worker.joinable())
+        worker.join();
+}
+
+bool InflateStream::isCompressed(IOStream* stream)
+{
+    unsigned char magic[2] = { 0, 0 };
+    if (stream->fileSize() < 2)
+        return false;
+    if (stream->data())
+        std::memcpy(magic, stream->data(), 2);
+    else
+    {
+        std::size_t at = stream->tell();
+        std::size_t got = stream->read(magic, 1, 2);
+        stream->seek(at, IO_SEEK_SET);
+        if (got < 2)
+            return false;
+    }
+    bool gzip = magic[0] == 0x1f && magic[1] == 0x8b;
+    bool zlib = (magic[0] & 0x0f) == 8 && (magic[0] >> 4) <= 7 && (magic[0] * 256 + magic[1]) % 31 == 0;
+    return gzip || zlib;
+}
+
+bool InflateStream::next(const char*& data, std::size_t& size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // hand the previous chunk back to the worker
+    if (held)
+    {
+        ready[readIdx] = false;
+        readIdx ^= 1;
+        held = false;
+        cond.notify_all();
+    }
+    cond.wait(lock, [this] { return ready[readIdx] || finished; });
+    if (!ready[readIdx])
+        return false;
+    data = &buffers[readIdx][0];
+    size = sizes[readIdx];
+    held = true;
+    return true;
+}
+
+void InflateStream::run()
+{
+    try
+    {
+        if (raw)
+            blocks();
+        else
+        {
+            // a gzip file may hold several members back to back
+            while (member())
+            {
+                if (overrun > 0)
+                    break;
+                if (bitCount == 0 && inPos >= inSize)
+                {
+                    inSize = source->read(&input[0], 1, input.size());
+                    inPos = 0;
+                    if (inSize == 0)
+                        break;
+                }
+            }
+        }
+        flush();
+    }
+    catch (const Abort&)
+    {
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    cond.notify_all();
+}
+
+bool InflateStream::member()
+{
+    need(16);
+    unsigned int b0 = bitBuf & 0xff, b1 = (bitBuf >> 8) & 0xff;
+    if (b0 == 0x1f && b1 == 0x8b)
+    {
+        // gzip header (RFC 1952)
+        bits(16);
+        if (bits(8) != 8)
+            fail("UNSUPPORTED_METHOD");
+        unsigned int flags = bits(8);
+        bits(16); bits(16); bits(8); bits(8); // mtime, xfl, os
+        if (flags & 4) // FEXTRA
+        {
+            unsigned int len = bits(16);
+            while (len--)
+                bits(8);
+        }
+        if (flags & 8) // FNAME
+            while (bits(8) != 0)
+                ;
+        if (flags & 16) // FCOMMENT
+            while (bits(8) != 0)
+                ;
+        if (flags & 2) // FHCRC
+            bits(16);
+
+        crc = 0;
+        outTotal = 0;
+        blocks();
+
+        // trailer: CRC32 and size of the uncompressed data
+        bits(bitCount & 7);
+        flush();
+        uint32_t storedCrc = bits(16);
+        storedCrc |= bits(16) << 16;
+        uint32_t storedSize = bits(16);
+        storedSize |= bits(16) << 16;
+        if (storedCrc != crc || storedSize != outTotal)
+            fail("CHECKSUM_MISMATCH");
+        return true;
+    }
+
+    if ((b0 & 0x0f) == 8 && (b0 * 256 + b1) % 31 == 0)
+    {
+        // zlib wrapper (RFC 1950), the adler32 trailer is skipped
+        bits(16);
+        if (b1 & 0x20)
+            fail("PRESET_DICTIONARY");
+        blocks();
+        bits(bitCount & 7);
+        bits(16);
+        bits(16);
+        return false;
+    }
+
+    // trailing garbage after a gzip member ends the stream, anything else is an error
+    if (outTotal == 0)
+        fail("UNKNOWN_FORMAT");
+    return false;
+}
+
+void InflateStream::blocks()
+{
+    // deflate data (RFC 1951): a sequence of blocks, the last one flagged
+    bool last = false;
+    while (!last)
+    {
+        last = bits(1);
+        unsigned int type = bits(2);
+        if (type == 0)
+        {
+            // stored block: byte aligned LEN/NLEN then raw bytes
+            bits(bitCount & 7);
+            unsigned int len = bits(16);
+            unsigned int nlen = bits(16);
+            if ((len ^ 0xffff) != nlen)
+                fail("CORRUPT_STORED_BLOCK");
+            while (len--)
+                emit((unsigned char)bits(8));
+        }
+        else if (type == 1)
+            block(fixedLit, fixedDist);
+        else if (type == 2)
+        {
+            Huffman lit, dist;
+            dynamicTables(lit, dist);
+            block(lit, dist);
+        }
+        else
+            fail("INVALID_BLOCK_TYPE");
+    }
+}
+
+void InflateStream::block(const Huffman& lit, const Huffman& dist)
+{
+    static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    while (true)
+    {
+        int symbol = decode(lit);
+        if (symbol < 256)
+        {
+            emit((unsigned char)symbol);
+            continue;
+        }
+        if (symbol == 256)
+            return;
+        symbol -= 257;
+        if (symbol >= 29)
+            fail("INVALID_LENGTH");
+        unsigned int length = lengthBase[symbol] + bits(lengthExtra[symbol]);
+        int d = decode(dist);
+        if (d >= 30)
+            fail("INVALID_DISTANCE");
+        unsigned int distance = distBase[d] + bits(distExtra[d]);
+        if (distance > windowPos)
+            fail("DISTANCE_TOO_FAR");
+        for (unsigned int i = 0; i < length; i++)
+            emit(window[(windowPos - distance) & 32767]);
+    }
+}
+
+void InflateStream::dynamicTables(Huffman& lit, Huffman& dist)
+{
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    unsigned int numLit = bits(5) + 257;
+    unsigned int numDist = bits(5) + 1;
+    unsigned int numCode = bits(4) + 4;
+
+    unsigned char codeLengths[19] = { 0 };
+    for (unsigned int i = 0; i < numCode; i++)
+        codeLengths[order[i]] = bits(3);
+    Huffman code;
+    if (!build(code, codeLengths, 19))
+        fail("INVALID_CODE_LENGTHS");
+
+    // literal/length and distance code lengths share one run-length coded sequence
+    unsigned char lengths[288 + 32] = { 0 };
+    unsigned int n = 0;
+    while (n < numLit + numDist)
+    {
+        int symbol = decode(code);
+        unsigned int repeat = 0;
+        unsigned char value = 0;
+        if (symbol < 16)
+        {
+            lengths[n++] = symbol;
+            continue;
+        }
+        else if (symbol == 16)
+        {
+            if (n == 0)
+                fail("INVALID_REPEAT");
+            value = lengths[n - 1];
+            repeat = 3 + bits(2);
+        }
+        else if (symbol == 17)
+            repeat = 3 + bits(3);
+        else
+            repeat = 11 + bits(7);
+        if (n + repeat > numLit + numDist)
+            fail("INVALID_REPEAT");
+        while (repeat--)
+            lengths[n++] = value;
+    }
+    if (!build(lit, lengths, numLit) || !build(dist, lengths + numLit, numDist))
+        fail("INVALID_HUFFMAN_TABLE");
+}
+
+bool InflateStream::build(Huffman& h, const unsigned char* lengths, int count)
+{
+    int counts[16] = { 0 };
+    h.maxBits = 0;
+    for (int i = 0; i < count; i++)
+    {
+        counts[lengths[i]]++;
+        if (lengths[i] > h.maxBits)
+            h.maxBits = lengths[i];
+    }
+    counts[0] = 0;
+    if (h.maxBits == 0)
+    {
+        // no codes at all (allowed for an unused distance table)
+        h.maxBits = 1;
+        h.table.assign(2, 0);
+        return true;
+    }
+
+    // canonical code assignment
+    int code = 0;
+    int nextCode[16] = { 0 };
+    for (int len = 1; len <= 15; len++)
+    {
+        code = (code + counts[len - 1]) << 1;
+        nextCode[len] = code;
+        if (nextCode[len] + counts[len] > (1 << len))
+            return false; // over-subscribed
+    }
+
+    // every code is entered at all table slots sharing its (bit-reversed) prefix
+    h.table.assign(std::size_t(1) << h.maxBits, 0);
+    for (int symbol = 0; symbol < count; symbol++)
+    {
+        int len = lengths[symbol];
+        if (len == 0)
+            continue;
+        int c = nextCode[len]++;
+        int reversed = 0;
+        for (int i = 0; i < len; i++)
+            reversed |= ((c >> i) & 1) << (len - 1 - i);
+        for (int slot = reversed; slot < (1 << h.maxBits); slot += 1 << len)
+            h.table[slot] = (uint16_t)((symbol << 4) | len);
+    }
+    return true;
+}
+
+int InflateStream::decode(const Huffman& h)
+{
+    need(h.maxBits);
+    uint16_t entry = h.table[bitBuf & ((1u << h.maxBits) - 1)];
+    int len = entry & 15;
+    if (len == 0)
+        fail("INVALID_CODE");
+    bitBuf >>= len;
+    bitCount -= len;
+    return entry >> 4;
+}
+
+int InflateStream::nextByte()
+{
+    if (inPos >= inSize)
+    {
+        inSize = source->read(&input[0], 1, input.size());
+        inPos = 0;
+        if (inSize == 0)
+        {
+            // allow a few bytes of zero padding for lookahead, more means truncated data
+            if (++overrun > 4)
+                fail("UNEXPECTED_END_OF_STREAM");
+            return 0;
+        }
+    }
+    return input[inPos++];
+}
+
+void InflateStream::need(int n)
+{
+    while (bitCount < n)
+    {
+        bitBuf |= (uint32_t)nextByte() << bitCount;
+        bitCount += 8;
+    }
+}
+
+uint32_t InflateStream::bits(int n)
+{
+    if (n == 0)
+        return 0;
+    need(n);
+    uint32_t value = bitBuf & ((1u << n) - 1);
+    bitBuf >>= n;
+    bitCount -= n;
+    return value;
+}
+
+void InflateStream::emit(unsigned char byte)
+{
+    window[windowPos & 32767] = byte;
+    windowPos++;
+    buffers[writeIdx][sizes[writeIdx]++] = (char)byte;
+    if (sizes[writeIdx] == chunkSize)
+        flush();
+}
+
+void InflateStream::flush()
+{
+    std::size_t size = sizes[writeIdx];
+    if (size == 0)
+        return;
+    crc = crc32(crc, &buffers[writeIdx][0], size);
+    outTotal += size;
+    buffers[writeIdx][size] = '\0';
+
+    // publish this chunk and wait until the consumer has released the other one
+    std::unique_lock<std::mutex> lock(mutex);
+    ready[writeIdx] = true;
+    cond.notify_all();
+    writeIdx ^= 1;
+    cond.wait(lock, [this] { return !ready[writeIdx] || cancelled; });
+    if (cancelled)
+        throw Abort();
+    sizes[writeIdx] = 0;
+}
+
+void InflateStream::fail(const char* what)
+{
+    std::cout << "ERROR::INFLATE::" << what << std::endl;
+    error = true;
+    throw Abort();
+}
+
+uint32_t InflateStream::crc32(uint32_t crc, const char* data, std::size_t size)
+{
+    // built once, thread-safe through static initialization
+    static const std::vector<uint32_t> table = []
+    {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; i++)
+        crc = table[(crc ^ (unsigned char)data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef IOSYSTEM_H
+#define IOSYSTEM_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// pluggable asset I/O, modeled on the IOSystem/IOStream pair in include/assimp:
+// loaders ask an IOSystem to open a name and read from the IOStream it hands back,
+// so the same loader works on loose files, mapped files, memory blobs and archives
+
+enum IOOrigin
+{
+    IO_SEEK_SET,
+    IO_SEEK_CUR,
+    IO_SEEK_END
+};
+
+// a readable stream of bytes
+class IOStream
+{
+public:
+    virtual ~IOStream() {}
+    // reads up to size * count bytes, returns the number of complete elements read
+    virtual std::size_t read(void* buffer, std::size_t size, std::size_t count) = 0;
+    virtual bool seek(long long offset, IOOrigin origin) = 0;
+    virtual std::size_t tell() const = 0;
+    virtual std::size_t fileSize() const = 0;
+    // the whole contents as one contiguous block if the backend has it in memory
+    // already (mapped files, memory blobs, stored archive entries), NULL otherwise
+    virtual const char* data() const { return NULL; }
+};
+
+// opens named streams
+class IOSystem
+{
+public:
+    virtual ~IOSystem() {}
+    virtual bool exists(const char* path) const = 0;
+    // returns NULL if the name cannot be opened
+    virtual IOStream* open(const char* path) = 0;
+    virtual void close(IOStream* stream) { delete stream; }
+
+    // reads the whole named stream into out
+    bool readAll(const char* path, std::string& out);
+};
+
+// stream over a block of memory, optionally owning it
+class MemoryIOStream : public IOStream
+{
+public:
+    MemoryIOStream(const char* begin, std::size_t size);
+    MemoryIOStream(std::vector<char>&& owned);
+    std::size_t read(void* buffer, std::size_t size, std::size_t count) override;
+    bool seek(long long offset, IOOrigin origin) override;
+    std::size_t tell() const override { return pos; }
+    std::size_t fileSize() const override { return size; }
+    const char* data() const override { return begin; }
+protected:
+    const char* begin;
+    std::size_t size;
+    std::size_t pos;
+    std::vector<char> owned;
+};
+
+// plain buffered file reads
+class FileIOStream : public IOStream
+{
+public:
+    FileIOStream(std::FILE* file);
+    ~FileIOStream();
+    std::size_t read(void* buffer, std::size_t size, std::size_t count) override;
+    bool seek(long long offset, IOOrigin origin) override;
+    std::size_t tell() const override;
+    std::size_t fileSize() const override { return size; }
+private:
+    std::FILE* file;
+    std::size_t size;
+};
+
+// read-only memory mapping of a whole file
+class MappedIOStream : public MemoryIOStream
+{
+public:
+    static MappedIOStream* map(const char* path);
+    ~MappedIOStream();
+private:
+    MappedIOStream(const char* begin, std::size_t size);
+#ifdef _WIN32
+    HANDLE fileHandle, mappingHandle;
+#endif
+};
+
+// loose files below a root directory
+class FileIOSystem : public IOSystem
+{
+public:
+    FileIOSystem(const std::string& root = "");
+    bool exists(const char* path) const override;
+    IOStream* open(const char* path) override;
+protected:
+    std::string root;
+};
+
+// loose files below a root directory, mapped instead of read
+class MMapIOSystem : public FileIOSystem
+{
+public:
+    MMapIOSystem(const std::string& root = "") : FileIOSystem(root) {}
+    IOStream* open(const char* path) override;
+};
+
+// named blobs registered by the application (not copied, they must outlive the system)
+class MemoryIOSystem : public IOSystem
+{
+public:
+    void add(const std::string& name, const char* data, std::size_t size);
+    bool exists(const char* path) const override;
+    IOStream* open(const char* path) override;
+private:
+    std::unordered_map<std::string, std::pair<const char*, std::size_t>> blobs;
+};
+
+// the plain file system, relative to the working directory
+IOSystem* defaultIOSystem();
+
+bool IOSystem::readAll(const char* path, std::string& out)
+{
+    IOStream* stream = open(path);
+    if (stream == NULL)
+        return false;
+    out.resize(stream->fileSize());
+    if (stream->data())
+        out.assign(stream->data(), stream->fileSize());
+    else if (!out.empty())
+        out.resize(stream->read(&out[0], 1, out.size()));
+    close(stream);
+    return true;
+}
+
+MemoryIOStream::MemoryIOStream(const char* begin, std::size_t size)
+{
+    this->begin = begin;
+    this->size = size;
+    pos = 0;
+}
+
+MemoryIOStream::MemoryIOStream(std::vector<char>&& owned) : owned(std::move(owned))
+{
+    begin = this->owned.empty() ? NULL : &this->owned[0];
+    size = this->owned.size();
+    pos = 0;
+}
+
+std::size_t MemoryIOStream::read(void* buffer, std::size_t size, std::size_t count)
+{
+    if (size == 0)
+        return 0;
+    std::size_t elements = std::min(count, (this->size - pos) / size);
+    std::memcpy(buffer, begin + pos, elements * size);
+    pos += elements * size;
+    return elements;
+}
+
+bool MemoryIOStream::seek(long long offset, IOOrigin origin)
+{
+    long long target = offset + (origin == IO_SEEK_SET ? 0 : origin == IO_SEEK_CUR ? (long long)pos : (long long)size);
+    if (target < 0 || target > (long long)size)
+        return false;
+    pos = (std::size_t)target;
+    return true;
+}
+
+FileIOStream::FileIOStream(std::FILE* file)
+{
+    this->file = file;
+    std::fseek(file, 0, SEEK_END);
+    size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+}
+
+FileIOStream::~FileIOStream()
+{
+    std::fclose(file);
+}
+
+std::size_t FileIOStream::read(void* buffer, std::size_t size, std::size_t count)
+{
+    return std::fread(buffer, size, count, file);
+}
+
+bool FileIOStream::seek(long long offset, IOOrigin origin)
+{
+    int whence = origin == IO_SEEK_SET ? SEEK_SET : origin == IO_SEEK_CUR ? SEEK_CUR : SEEK_END;
+    return std::fseek(file, (long)offset, whence) == 0;
+}
+
+std::size_t FileIOStream::tell() const
+{
+    return std::ftell(file);
+}
+
+MappedIOStream::MappedIOStream(const char* begin, std::size_t size) : MemoryIOStream(begin, size)
+{
+#ifdef _WIN32
+    fileHandle = mappingHandle = NULL;
+#endif
+}
+
+MappedIOStream* MappedIOStream::map(const char* path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    if (size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return new MappedIOStream("", 0);
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const char* view = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (view == NULL)
+    {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return NULL;
+    }
+    MappedIOStream* stream = new MappedIOStream(view, (std::size_t)size.QuadPart);
+    stream->fileHandle = file;
+    stream->mappingHandle = mapping;
+    return stream;
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        return NULL;
+    }
+    if (info.st_size == 0)
+    {
+        ::close(fd);
+        return new MappedIOStream("", 0);
+    }
+    void* view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (view == MAP_FAILED)
+        return NULL;
+    madvise(view, info.st_size, MADV_SEQUENTIAL);
+    return new MappedIOStream((const char*)view, info.st_size);
+#endif
+}
+
+MappedIOStream::~MappedIOStream()
+{
+    if (size == 0)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(begin);
+    CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+#else
+    munmap((void*)begin, size);
+#endif
+}
+
+FileIOSystem::FileIOSystem(const std::string& root)
+{
+    this->root = root;
+}
+
+bool FileIOSystem::exists(const char* path) const
+{
+    std::FILE* file = std::fopen((root + path).c_str(), "rb");
+    if (file == NULL)
+        return false;
+    std::fclose(file);
+    return true;
+}
+
+IOStream* FileIOSystem::open(const char* path)
+{
+    std::FILE* file = std::fopen((root + path).c_str(), "rb");
+    return file ? new FileIOStream(file) : NULL;
+}
+
+IOStream* MMapIOSystem::open(const char* path)
+{
+    return MappedIOStream::map((root + path).c_str());
+}
+
+void MemoryIOSystem::add(const std::string& name, const char* data, std::size_t size)
+{
+    blobs[name] = std::make_pair(data, size);
+}
+
+bool MemoryIOSystem::exists(const char* path) const
+{
+    return blobs.count(path) > 0;
+}
+
+IOStream* MemoryIOSystem::open(const char* path)
+{
+    auto found = blobs.find(path);
+    if (found == blobs.end())
+        return NULL;
+    return new MemoryIOStream(found->second.first, found->second.second);
+}
+
+IOSystem* defaultIOSystem()
+{
+    static FileIOSystem files;
+    return &files;
+}
+
+#endif
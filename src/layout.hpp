@@ -0,0 +1,349 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+// vertex storage layouts for CPU-side processing, selected at compile time:
+//   AoSLayout      interleaved vec3s, position then (optionally) normal; the GL upload layout
+//                  (Mesh::triangles, Mesh::indexedVertices)
+//   SoALayout      one float array per component, every component loads 4 or 8 vertices at once
+//   AoSoALayout<W> blocks of W vertices, each block holding W x, W y, ... so a block is one
+//                  contiguous W-wide load per component and stays within a few cache lines
+// every VertexStorage has the same inline accessors, so the algorithms below are written once
+// and compile to plain indexing for each layout; SoA and AoSoA also get kernels of their own
+// that walk the component arrays directly, so the compiler vectorizes them
+struct AoSLayout {};
+struct SoALayout {};
+template <unsigned int Width> struct AoSoALayout {};
+
+template <typename Layout> class VertexStorage;
+
+template <>
+class VertexStorage<AoSLayout>
+{
+public:
+    std::vector<glm::vec3> data;
+    unsigned int stride = 1; // vec3s per vertex
+    std::size_t count = 0;
+
+    void resize(std::size_t count, bool normals)
+    {
+        this->count = count;
+        stride = normals ? 2 : 1;
+        data.resize(count * stride);
+    }
+    bool hasNormals() const { return stride == 2; }
+    glm::vec3 position(std::size_t i) const { return data[i * stride]; }
+    glm::vec3 normal(std::size_t i) const { return data[i * stride + 1]; }
+    void setPosition(std::size_t i, const glm::vec3& p) { data[i * stride] = p; }
+    void setNormal(std::size_t i, const glm::vec3& n) { data[i * stride + 1] = n; }
+};
+
+template <>
+class VertexStorage<SoALayout>
+{
+public:
+    std::vector<float> px, py, pz;
+    std::vector<float> nx, ny, nz; // empty without normals
+    std::size_t count = 0;
+
+    void resize(std::size_t count, bool normals)
+    {
+        this->count = count;
+        px.resize(count);
+        py.resize(count);
+        pz.resize(count);
+        nx.resize(normals ? count : 0);
+        ny.resize(normals ? count : 0);
+        nz.resize(normals ? count : 0);
+    }
+    bool hasNormals() const { return !nx.empty(); }
+    glm::vec3 position(std::size_t i) const { return glm::vec3(px[i], py[i], pz[i]); }
+    glm::vec3 normal(std::size_t i) const { return glm::vec3(nx[i], ny[i], nz[i]); }
+    void setPosition(std::size_t i, const glm::vec3& p) { px[i] = p.x; py[i] = p.y; pz[i] = p.z; }
+    void setNormal(std::size_t i, const glm::vec3& n) { nx[i] = n.x; ny[i] = n.y; nz[i] = n.z; }
+
+    // de-interleaves a stride 1 (position) or stride 2 (position, normal) vec3 stream
+    void assign(const std::vector<glm::vec3>& interleaved, unsigned int stride);
+};
+
+template <unsigned int Width>
+class VertexStorage<AoSoALayout<Width>>
+{
+public:
+    static_assert((Width & (Width - 1)) == 0, "the block width has to be a power of two");
+    // blocks of Width lanes: x[Width] y[Width] z[Width] (nx[Width] ny[Width] nz[Width]), the
+    // last block padded with zeros
+    std::vector<float> blocks;
+    unsigned int components = 3;
+    std::size_t count = 0;
+
+    void resize(std::size_t count, bool normals)
+    {
+        this->count = count;
+        components = normals ? 6 : 3;
+        blocks.resize(blockCount() * Width * components);
+        for (std::size_t i = count; i < blockCount() * Width; i++)
+            for (unsigned int c = 0; c < components; c++)
+                at(i, c) = 0.0f;
+    }
+    bool hasNormals() const { return components == 6; }
+    std::size_t blockCount() const { return (count + Width - 1) / Width; }
+    // component c (0-2 position, 3-5 normal) of vertex i
+    float& at(std::size_t i, unsigned int c) { return blocks[(i / Width * components + c) * Width + i % Width]; }
+    float at(std::size_t i, unsigned int c) const { return blocks[(i / Width * components + c) * Width + i % Width]; }
+    glm::vec3 position(std::size_t i) const { return glm::vec3(at(i, 0), at(i, 1), at(i, 2)); }
+    glm::vec3 normal(std::size_t i) const { return glm::vec3(at(i, 3), at(i, 4), at(i, 5)); }
+    void setPosition(std::size_t i, const glm::vec3& p) { at(i, 0) = p.x; at(i, 1) = p.y; at(i, 2) = p.z; }
+    void setNormal(std::size_t i, const glm::vec3& n) { at(i, 3) = n.x; at(i, 4) = n.y; at(i, 5) = n.z; }
+};
+
+void VertexStorage<SoALayout>::assign(const std::vector<glm::vec3>& interleaved, unsigned int stride)
+{
+    resize(interleaved.size() / stride, stride == 2);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        setPosition(i, interleaved[i * stride]);
+        if (stride == 2)
+            setNormal(i, interleaved[i * stride + 1]);
+    }
+}
+
+// conversion between any two layouts
+template <typename From, typename To>
+void convertLayout(const VertexStorage<From>& in, VertexStorage<To>& out)
+{
+    out.resize(in.count, in.hasNormals());
+    for (std::size_t i = 0; i < in.count; i++)
+        out.setPosition(i, in.position(i));
+    if (in.hasNormals())
+        for (std::size_t i = 0; i < in.count; i++)
+            out.setNormal(i, in.normal(i));
+}
+
+// positions by the affine transform, normals by its normal matrix
+template <typename Layout>
+void transformLayout(const VertexStorage<Layout>& in, const glm::mat4& transform, VertexStorage<Layout>& out)
+{
+    out.resize(in.count, in.hasNormals());
+    glm::mat3 linear(transform);
+    glm::vec3 offset(transform[3]);
+    for (std::size_t i = 0; i < in.count; i++)
+        out.setPosition(i, linear * in.position(i) + offset);
+    if (in.hasNormals())
+    {
+        glm::mat3 normal = glm::transpose(glm::inverse(linear));
+        for (std::size_t i = 0; i < in.count; i++)
+            out.setNormal(i, normal * in.normal(i));
+    }
+}
+
+// axis-aligned bounds of the positions
+template <typename Layout>
+void boundsLayout(const VertexStorage<Layout>& in, glm::vec3& lower, glm::vec3& upper)
+{
+    lower = glm::vec3(std::numeric_limits<float>::max());
+    upper = glm::vec3(-std::numeric_limits<float>::max());
+    for (std::size_t i = 0; i < in.count; i++)
+    {
+        glm::vec3 p = in.position(i);
+        lower = glm::min(lower, p);
+        upper = glm::max(upper, p);
+    }
+}
+
+// AoSoA versions walk whole blocks: the inner loops run over Width contiguous lanes of each
+// component, which the compiler turns into Width-wide vector code
+template <unsigned int Width>
+void transformLayout(const VertexStorage<AoSoALayout<Width>>& in, const glm::mat4& transform,
+                     VertexStorage<AoSoALayout<Width>>& out)
+{
+    out.resize(in.count, in.hasNormals());
+    float m[12];
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++)
+            m[r * 4 + c] = transform[c][r];
+    glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(transform)));
+    unsigned int components = in.components;
+    for (std::size_t b = 0; b < in.blockCount(); b++)
+    {
+        const float* src = &in.blocks[b * components * Width];
+        float* dst = &out.blocks[b * components * Width];
+        for (unsigned int l = 0; l < Width; l++)
+        {
+            float x = src[l], y = src[Width + l], z = src[2 * Width + l];
+            dst[l] = m[0] * x + m[1] * y + m[2] * z + m[3];
+            dst[Width + l] = m[4] * x + m[5] * y + m[6] * z + m[7];
+            dst[2 * Width + l] = m[8] * x + m[9] * y + m[10] * z + m[11];
+        }
+        if (components == 6)
+        {
+            for (unsigned int l = 0; l < Width; l++)
+            {
+                float x = src[3 * Width + l], y = src[4 * Width + l], z = src[5 * Width + l];
+                dst[3 * Width + l] = normal[0][0] * x + normal[1][0] * y + normal[2][0] * z;
+                dst[4 * Width + l] = normal[0][1] * x + normal[1][1] * y + normal[2][1] * z;
+                dst[5 * Width + l] = normal[0][2] * x + normal[1][2] * y + normal[2][2] * z;
+            }
+        }
+    }
+}
+
+template <unsigned int Width>
+void boundsLayout(const VertexStorage<AoSoALayout<Width>>& in, glm::vec3& lower, glm::vec3& upper)
+{
+    // per-lane bounds first (the padding lanes of the last block are left out afterwards)
+    float lo[3][Width], hi[3][Width];
+    for (unsigned int c = 0; c < 3; c++)
+        for (unsigned int l = 0; l < Width; l++)
+        {
+            lo[c][l] = std::numeric_limits<float>::max();
+            hi[c][l] = -std::numeric_limits<float>::max();
+        }
+    std::size_t fullBlocks = in.count / Width;
+    for (std::size_t b = 0; b < fullBlocks; b++)
+    {
+        const float* src = &in.blocks[b * in.components * Width];
+        for (unsigned int c = 0; c < 3; c++)
+            for (unsigned int l = 0; l < Width; l++)
+            {
+                lo[c][l] = std::min(lo[c][l], src[c * Width + l]);
+                hi[c][l] = std::max(hi[c][l], src[c * Width + l]);
+            }
+    }
+    lower = glm::vec3(std::numeric_limits<float>::max());
+    upper = glm::vec3(-std::numeric_limits<float>::max());
+    for (unsigned int l = 0; l < Width; l++)
+    {
+        lower = glm::min(lower, glm::vec3(lo[0][l], lo[1][l], lo[2][l]));
+        upper = glm::max(upper, glm::vec3(hi[0][l], hi[1][l], hi[2][l]));
+    }
+    for (std::size_t i = fullBlocks * Width; i < in.count; i++)
+    {
+        lower = glm::min(lower, in.position(i));
+        upper = glm::max(upper, in.position(i));
+    }
+}
+
+// SoA versions run over each component array at once, one independent lane per vertex
+inline void transformLayout(const VertexStorage<SoALayout>& in, const glm::mat4& transform, VertexStorage<SoALayout>& out)
+{
+    out.resize(in.count, in.hasNormals());
+    const float* x = in.px.data();
+    const float* y = in.py.data();
+    const float* z = in.pz.data();
+    float* ox = out.px.data();
+    float* oy = out.py.data();
+    float* oz = out.pz.data();
+    const glm::mat4& m = transform;
+    for (std::size_t i = 0; i < in.count; i++)
+    {
+        ox[i] = m[0][0] * x[i] + m[1][0] * y[i] + m[2][0] * z[i] + m[3][0];
+        oy[i] = m[0][1] * x[i] + m[1][1] * y[i] + m[2][1] * z[i] + m[3][1];
+        oz[i] = m[0][2] * x[i] + m[1][2] * y[i] + m[2][2] * z[i] + m[3][2];
+    }
+    if (in.hasNormals())
+    {
+        glm::mat3 n = glm::transpose(glm::inverse(glm::mat3(transform)));
+        x = in.nx.data(), y = in.ny.data(), z = in.nz.data();
+        ox = out.nx.data(), oy = out.ny.data(), oz = out.nz.data();
+        for (std::size_t i = 0; i < in.count; i++)
+        {
+            ox[i] = n[0][0] * x[i] + n[1][0] * y[i] + n[2][0] * z[i];
+            oy[i] = n[0][1] * x[i] + n[1][1] * y[i] + n[2][1] * z[i];
+            oz[i] = n[0][2] * x[i] + n[1][2] * y[i] + n[2][2] * z[i];
+        }
+    }
+}
+
+inline void boundsLayout(const VertexStorage<SoALayout>& in, glm::vec3& lower, glm::vec3& upper)
+{
+    const std::vector<float>* components[3] = { &in.px, &in.py, &in.pz };
+    for (int c = 0; c < 3; c++)
+    {
+        // one reduction per component, which vectorizes where a min over vec3s does not
+        const float* v = components[c]->data();
+        float lo = std::numeric_limits<float>::max(), hi = -std::numeric_limits<float>::max();
+        for (std::size_t i = 0; i < in.count; i++)
+        {
+            lo = v[i] < lo ? v[i] : lo;
+            hi = v[i] > hi ? v[i] : hi;
+        }
+        lower[c] = lo;
+        upper[c] = hi;
+    }
+}
+
+// rescales the normals to unit length (zero normals stay zero)
+template <typename Layout>
+void normalizeLayout(VertexStorage<Layout>& in)
+{
+    if (!in.hasNormals())
+        return;
+    for (std::size_t i = 0; i < in.count; i++)
+    {
+        glm::vec3 n = in.normal(i);
+        float length2 = glm::dot(n, n);
+        in.setNormal(i, length2 > 0.0f ? n / std::sqrt(length2) : n);
+    }
+}
+
+// the lanes of (x, y, z) component arrays scaled to unit length, branch free
+inline void normalizeLanes(float* x, float* y, float* z, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++)
+    {
+        float length2 = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+        float scale = length2 > 0.0f ? 1.0f / std::sqrt(length2) : 0.0f;
+        x[i] *= scale;
+        y[i] *= scale;
+        z[i] *= scale;
+    }
+}
+
+inline void normalizeLayout(VertexStorage<SoALayout>& in)
+{
+    if (in.hasNormals())
+        normalizeLanes(in.nx.data(), in.ny.data(), in.nz.data(), in.count);
+}
+
+template <unsigned int Width>
+void normalizeLayout(VertexStorage<AoSoALayout<Width>>& in)
+{
+    // the padding lanes are zero and stay zero
+    if (!in.hasNormals())
+        return;
+    for (std::size_t b = 0; b < in.blockCount(); b++)
+    {
+        float* n = &in.blocks[(b * in.components + 3) * Width];
+        normalizeLanes(n, n + Width, n + 2 * Width, Width);
+    }
+}
+
+// smooth normals from the faces: every triangle (three vertex ids per corner in corners) adds
+// its area weighted normal to its vertices, which are then normalized; the positions are
+// read and the normals written through the layout, the normalization runs on its own kernel
+template <typename Layout>
+void generateNormalsLayout(VertexStorage<Layout>& vertices, const std::vector<unsigned int>& corners)
+{
+    if (!vertices.hasNormals())
+        return;
+    for (std::size_t i = 0; i < vertices.count; i++)
+        vertices.setNormal(i, glm::vec3(0.0f));
+    for (std::size_t c = 0; c + 2 < corners.size(); c += 3)
+    {
+        glm::vec3 a = vertices.position(corners[c]), b = vertices.position(corners[c + 1]), d = vertices.position(corners[c + 2]);
+        glm::vec3 n = glm::cross(b - a, d - a);
+        for (int k = 0; k < 3; k++)
+            vertices.setNormal(corners[c + k], vertices.normal(corners[c + k]) + n);
+    }
+    normalizeLayout(vertices);
+}
+
+#endif
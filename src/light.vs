@@ -4,9 +4,22 @@ layout (location = 1) in vec3 aNormal;
 
 out vec3 Normal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-frame block shared by every program (see uniforms.hpp)
+layout (std140, binding = 0) uniform Frame
+{
+    mat4 view;
+    mat4 projection;
+    vec3 lightPos;
+    vec3 lightColor;
+    vec3 viewPos;
+};
+// per-object block, the normal matrix is computed once on the CPU
+layout (std140, binding = 1) uniform Object
+{
+    mat4 model;
+    mat3 normalMatrix;
+    vec3 objectColor;
+};
 
 void main()
 {
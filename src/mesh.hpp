@@ -11,17 +11,59 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/string_cast.hpp>
 
+#include "iosystem.hpp"
+#include "inflate.hpp"
+#include "transform.hpp"
+#include "threadpool.hpp"
+#include "streambuffer.hpp"
+
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <unordered_map>
+#include <iterator>
+#include <cstdlib>
+#include <cstring>
+
+// vertex attributes the loader can produce, combine with |
+enum MeshAttribute
+{
+    ATTRIB_POSITION = 1,
+    ATTRIB_NORMAL = 2
+};
+
+// vertex streams that load() can upload, combine with |
+enum MeshStream
+{
+    STREAM_INTERLEAVED = 1, // position + normal, 24 bytes per vertex (lit shading models)
+    STREAM_POSITION = 2     // tightly packed positions, 12 bytes per vertex (depth-only passes)
+};
+
+// regions of the CPU transform's dynamic vertex buffer
+const unsigned int MESH_TRANSFORM_REGIONS = 3;
+
+// a contiguous range of the index buffer whose indices are relative to baseVertex
+struct SubMesh
+{
+    unsigned int firstIndex;  // offset into the index buffer (in indices)
+    unsigned int indexCount;
+    unsigned int baseVertex;  // first vertex of the range in the shared vertex buffer
+    unsigned int vertexCount;
+};
 
 class Mesh
 {
 public:
     // the vertex array object, vertex buffor object, and element buffer object
     unsigned int VAO, VBO, EBO;
+    // the position-only vertex array object and its de-interleaved vertex buffer
+    unsigned int positionVAO, positionVBO;
+    // which MeshStream buffers load() created
+    unsigned int streams;
+    // which MeshAttribute data was parsed (triangles only holds normals with ATTRIB_NORMAL)
+    unsigned int attributes;
     // the storage container for the vertices
     std::vector<glm::vec3> vertices;
     // the storage container for the normals
@@ -29,147 +71,431 @@ public:
     // the storage container for our faces (contains the triangle vertex indices)
     std::vector<glm::ivec3> faces;
      // the storage container for our triangles
-    std::vector<glm::vec3> triangles; // contains triangle EBO vertices plus their normal vectors
-    // the container of transformed triangles to be returned (for use with CPU transformations)
-    std::vector<glm::vec3> transformedTriangles;
+    std::vector<glm::vec3> triangles; // contains triangle EBO vertices plus their normal vectors (if parsed)
+    // ring of dynamic vertex buffer regions the CPU transform writes to (laid out like
+    // indexedVertices), the vertex array object reading it, and the region written last
+    // (-1 while the static buffers are drawn)
+    StreamBuffer transformStream;
+    unsigned int transformVAO;
+    int transformRegion;
+    // TransformState version the stream region holds (0 for a plain matrix)
+    unsigned long long transformVersion;
+    // structure-of-arrays copy of indexedVertices the CPU transform reads from (built on first use)
+    VertexSoA transformSource;
+
+    // indexed geometry: unique vertices (same layout as triangles) grouped per submesh,
+    // and either 16-bit submesh-relative indices or 32-bit indices as a fallback
+    std::vector<glm::vec3> indexedVertices;
+    std::vector<unsigned short> shortIndices;
+    std::vector<unsigned int> longIndices;
+    std::vector<SubMesh> submeshes;
+    unsigned int indexType; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+
+    // baked ambient occlusion per indexed vertex (255 = fully open, see ambient.hpp), fed to
+    // the shaders as attribute 2; empty when none was baked
+    std::vector<unsigned char> occlusion;
+    unsigned int occlusionVBO;
 
     // keep track of largest vertex for initial scaling on load-up
     glm::vec3 largestVertex;
 
-    // constructor reads .obj file and builds the VBO and VAO
-    Mesh(const char* objPath);
-    void load(); // initializes the buffers by binding them and doing other OpenGL stuff
+    // constructor reads .obj file and builds the VBO and VAO, parsing only the requested attributes
+    // (the file is opened through io, or the plain file system when that is NULL)
+    Mesh(const char* objPath, unsigned int attributes = ATTRIB_POSITION | ATTRIB_NORMAL, IOSystem* io = NULL);
+    Mesh(); // empty mesh (e.g. when the geometry is streamed in some other way)
+    void load(unsigned int streams = STREAM_INTERLEAVED); // initializes the buffers by binding them and doing other OpenGL stuff
     void render(); // draws the arrays
+    void renderPositions(); // draws the arrays fetching positions only
     void unload(); // unbinds and deletes objects
-    void applyTransform(glm::mat4 transform); // for use with CPU transformations
+    // for use with CPU transformations: transforms on the pool (the default one when NULL) straight
+    // into the next free region of the dynamic vertex buffer, which render() draws from then on
+    void applyTransform(glm::mat4 transform, ThreadPool* pool = NULL);
+    // the same, skipped while the state's version matches the last one applied; returns whether
+    // any vertices were transformed
+    bool applyTransform(TransformState& state, ThreadPool* pool = NULL);
+    void resetTransform(); // draws the untransformed static buffers again (back to GPU transformations)
+    // stores one occlusion value per indexed vertex and uploads it if the mesh is loaded
+    void setOcclusion(const std::vector<unsigned char>& values);
+    unsigned int stride() const { return attributes & ATTRIB_NORMAL ? 2 : 1; } // vec3s per vertex in triangles
+    // replaces the normals with area-weighted averages of the faces sharing each position
+    void generateNormals();
+    // welds identical vertices and splits the mesh into ranges that fit 16-bit indices
+    // (falls back to one 32-bit range when ranges cannot be drawn with a base vertex)
+    void buildIndices(bool allowSplit = true, unsigned int maxRangeVertices = 65536);
 private:
+    // draws every submesh with the currently bound vertex array, offset by baseOffset vertices
+    void drawElements(unsigned int baseOffset = 0);
+    // draws the region of the dynamic vertex buffer written last, returns false if there is none
+    bool renderTransformed();
+    // fills the occlusion buffer and points attribute 2 of the bound vertex array at it
+    void bindOcclusion();
+    // scratch index lists reused for every face record
+    std::vector<int> faceIndices;
+    std::vector<int> normIndices;
+
+    // parses every complete line of a chunk, partial lines are carried over to the next chunk
+    void parseChunk(const char* data, const char* end, std::string& carry);
+    // parses a single .obj record
+    void parseLine(const char* line, const char* end);
+    // builds the triangles container from the parsed vertices, normals and faces
+    void assemble();
     // triangulation method used to split non-triangular object faces into triangles
-    void triangulate(std::vector<int> vertIndices, std::vector<int> normIndices, std::vector<glm::ivec3>& faces);
+    void triangulate(const std::vector<int>& vertIndices, const std::vector<int>& normIndices, std::vector<glm::ivec3>& faces);
 };
 
-Mesh::Mesh(const char* objPath)
+Mesh::Mesh()
 {
-    // 1. retrieve the raw data from the obj file
-    std::ifstream objFile;
-    // open file
-    objFile.open(objPath);
-    std::string line;
-    // initialize largest vertex
+    VAO = VBO = EBO = 0;
+    positionVAO = positionVBO = 0;
+    transformVAO = 0;
+    transformRegion = -1;
+    transformVersion = 0;
+    occlusionVBO = 0;
+    streams = 0;
+    attributes = ATTRIB_POSITION | ATTRIB_NORMAL;
+    indexType = GL_UNSIGNED_INT;
     largestVertex = glm::vec3(0.0);
+}
+
+Mesh::Mesh(const char* objPath, unsigned int attributes, IOSystem* io) : Mesh()
+{
+    this->attributes = attributes | ATTRIB_POSITION;
+
+    // 1. retrieve the raw data from the obj file
+    if (io == NULL)
+        io = defaultIOSystem();
+    IOStream* objFile = io->open(objPath);
+    if (objFile == NULL)
+    {
+        std::cout << "ERROR::MESH::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
+        return;
+    }
 
-    while (std::getline(objFile, line))
+    std::string carry;
+    if (InflateStream::isCompressed(objFile))
     {
-        // check v for vertices
-        if (line.substr(0,2) == "v ")
+        // gzip/zlib compressed files are inflated on a worker thread while we parse
+        InflateStream stream(objFile);
+        const char* chunk;
+        std::size_t size;
+        while (stream.next(chunk, size))
+            parseChunk(chunk, chunk + size, carry);
+        if (stream.failed())
+            std::cout << "ERROR::MESH::DECOMPRESSION_FAILED" << std::endl;
+    }
+    else if (objFile->data())
+    {
+        // mapped or in-memory sources are parsed in place
+        parseChunk(objFile->data(), objFile->data() + objFile->fileSize(), carry);
+    }
+    else
+    {
+        // read the whole file in one go and walk it line by line
+        std::string data(objFile->fileSize(), '\0');
+        if (!data.empty())
+            data.resize(objFile->read(&data[0], 1, data.size()));
+        parseChunk(data.c_str(), data.c_str() + data.size(), carry);
+    }
+    if (!carry.empty())
+        parseLine(carry.c_str(), carry.c_str() + carry.size());
+    io->close(objFile);
+
+    // 2. set up mesh data
+    assemble();
+}
+
+void Mesh::parseChunk(const char* data, const char* end, std::string& carry)
+{
+    const char* cursor = data;
+    // finish the line left over from the previous chunk
+    if (!carry.empty())
+    {
+        const char* lineEnd = (const char*)std::memchr(cursor, '\n', end - cursor);
+        if (lineEnd == NULL)
         {
-            std::istringstream v(line.substr(2));
-            glm::vec3 vert;
-            double x, y, z;
-            v >> x, v >> y, v >> z;
-            vert = glm::vec3(x, y, z);
-            vertices.push_back(vert);
-
-            // check for largest vertex
-            if (glm::length(vert) > glm::length(largestVertex))
-                largestVertex = vert;
+            carry.append(cursor, end);
+            return;
         }
-
-        // check vn for normals
-        else if (line.substr(0, 2) == "vn")
+        carry.append(cursor, lineEnd);
+        parseLine(carry.c_str(), carry.c_str() + carry.size());
+        carry.clear();
+        cursor = lineEnd + 1;
+    }
+    while (cursor < end)
+    {
+        const char* lineEnd = (const char*)std::memchr(cursor, '\n', end - cursor);
+        if (lineEnd == NULL)
         {
-            std::istringstream vn(line.substr(2));
-            glm::vec3 norm;
-            double x, y, z;
-            vn >> x, vn >> y, vn >> z;
-            norm = glm::vec3(x, y, z);
-            normals.push_back(norm);
+            // incomplete line, keep it for the next chunk
+            carry.assign(cursor, end);
+            return;
         }
+        parseLine(cursor, lineEnd);
+        cursor = lineEnd + 1;
+    }
+}
 
-        // check f for faces
-        else if (line.substr(0,2) == "f ")
-        {
-            std::istringstream f(line.substr(2));
-            std::string v;
-            std::string::size_type pos;
-            std::vector<int> faceIndices;
-            std::vector<int> normIndices;
+void Mesh::parseLine(const char* line, const char* end)
+{
+    // only v, vn and f records are of interest, everything else (vt, comments, groups,
+    // materials) is rejected on its first two characters without being tokenized
+    if (end - line < 2)
+        return;
 
-            while (f >> v)
+    // check v for vertices
+    if (line[0] == 'v' && line[1] == ' ')
+    {
+        char* next = (char*)line + 2;
+        glm::vec3 vert;
+        vert.x = std::strtof(next, &next);
+        vert.y = std::strtof(next, &next);
+        vert.z = std::strtof(next, &next);
+        vertices.push_back(vert);
+
+        // check for largest vertex
+        if (glm::dot(vert, vert) > glm::dot(largestVertex, largestVertex))
+            largestVertex = vert;
+    }
+
+    // check vn for normals (skipped entirely when the shader has no use for them)
+    else if (line[0] == 'v' && line[1] == 'n')
+    {
+        if (!(attributes & ATTRIB_NORMAL))
+            return;
+        char* next = (char*)line + 2;
+        glm::vec3 norm;
+        norm.x = std::strtof(next, &next);
+        norm.y = std::strtof(next, &next);
+        norm.z = std::strtof(next, &next);
+        normals.push_back(norm);
+    }
+
+    // check f for faces (v, v/vt, v//vn or v/vt/vn)
+    else if (line[0] == 'f' && line[1] == ' ')
+    {
+        faceIndices.clear();
+        normIndices.clear();
+        const char* c = line + 2;
+        while (true)
+        {
+            while (c < end && (*c == ' ' || *c == '\t' || *c == '\r'))
+                c++;
+            if (c >= end)
+                break;
+
+            // vertex index (negative indices are relative to the end of the list)
+            char* next;
+            long idx = std::strtol(c, &next, 10);
+            if (next == c)
+                break;
+            faceIndices.push_back(idx < 0 ? (int)vertices.size() + idx : idx - 1);
+            c = next;
+
+            // skip the texture coordinate and pick up the normal index only if requested
+            int normIdx = -1;
+            if (c < end && *c == '/')
             {
-                pos = v.find('/');
-                int idx = stoi(v.substr(0, pos));
-                idx--;
-                faceIndices.push_back(idx);
-
-                std::string::size_type oldPos = pos;
-                pos = v.find(' ', oldPos);
-                oldPos += 2;
-                idx = stoi(v.substr(oldPos, pos));
-                idx--;
-                normIndices.push_back(idx);
+                c++;
+                while (c < end && *c != '/' && *c != ' ' && *c != '\t' && *c != '\r')
+                    c++;
+                if (c < end && *c == '/')
+                {
+                    c++;
+                    if (attributes & ATTRIB_NORMAL)
+                    {
+                        idx = std::strtol(c, &next, 10);
+                        if (next != c)
+                            normIdx = idx < 0 ? (int)normals.size() + idx : idx - 1;
+                        c = next;
+                    }
+                    while (c < end && *c != ' ' && *c != '\t' && *c != '\r')
+                        c++;
+                }
             }
+            normIndices.push_back(normIdx);
+        }
 
+        if (faceIndices.size() >= 3)
             triangulate(faceIndices, normIndices, faces);
-        }
     }
+}
 
-    // 2. set up mesh data
-    // add each vertex and corresponding normal to the triangles storage container
+void Mesh::assemble()
+{
+    // add each vertex and (if requested) corresponding normal to the triangles storage container
+    bool withNormals = attributes & ATTRIB_NORMAL;
+    triangles.clear();
+    triangles.reserve(faces.size() / 2 * 3 * stride());
 
     for (unsigned int i = 0; i < faces.size() / 2; i++)
     {
         int idx = i * 2;
         glm::ivec3 triangle = faces.at(idx);
         glm::ivec3 normal = faces.at(idx+1);
-        triangles.push_back(vertices.at(triangle.x));
-        triangles.push_back(normals.at(normal.x));
-        triangles.push_back(vertices.at(triangle.y));
-        triangles.push_back(normals.at(normal.y));
-        triangles.push_back(vertices.at(triangle.z));
-        triangles.push_back(normals.at(normal.z));
-    }
+        if (triangle.x < 0 || triangle.y < 0 || triangle.z < 0 || triangle.x >= (int)vertices.size() ||
+            triangle.y >= (int)vertices.size() || triangle.z >= (int)vertices.size())
+        {
+            std::cout << "ERROR::MESH::INVALID_FACE_INDEX" << std::endl;
+            continue;
+        }
+        glm::vec3 a = vertices[triangle.x], b = vertices[triangle.y], c = vertices[triangle.z];
+        if (!withNormals)
+        {
+            triangles.push_back(a);
+            triangles.push_back(b);
+            triangles.push_back(c);
+            continue;
+        }
 
-    // initialize the transformed triangles container (not used when GPU is doing the work)
-    transformedTriangles = triangles;
+        // faces without (valid) normal indices get their geometric normal
+        glm::vec3 faceNormal = glm::cross(b - a, c - a);
+        if (glm::dot(faceNormal, faceNormal) > 0.0f)
+            faceNormal = glm::normalize(faceNormal);
+        auto normalAt = [&](int n) { return n >= 0 && n < (int)normals.size() ? normals[n] : faceNormal; };
+        triangles.push_back(a);
+        triangles.push_back(normalAt(normal.x));
+        triangles.push_back(b);
+        triangles.push_back(normalAt(normal.y));
+        triangles.push_back(c);
+        triangles.push_back(normalAt(normal.z));
+    }
 }
 
-void Mesh::load()
+void Mesh::load(unsigned int streams)
 {
-    // 3. set up vertex buffers
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    //glGenBuffers(1, &EBO);
-    // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    
-    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * triangles.size(), &triangles[0].x, GL_STATIC_DRAW);
-    //glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::ivec3) * faces.size(), &faces[0].x, GL_STATIC_DRAW);
-
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // normal attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-
-    // bind the buffers
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-
-    // bind the vertex array
-    glBindVertexArray(0);
+    // without normals the triangles container already is a packed position stream
+    if (stride() == 1)
+        streams = STREAM_POSITION;
+    this->streams = streams;
+    // meshes built elsewhere (asset packs, static batches) may come indexed without triangles
+    if (triangles.empty() && indexedVertices.empty())
+        return;
+
+    // 3. index the geometry once; base vertex draws are core since GL 3.2
+    if (submeshes.empty())
+        buildIndices(GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex);
+
+    // the element buffer is shared by both vertex array objects
+    glGenBuffers(1, &EBO);
+
+    // 4. set up vertex buffers
+    if (streams & STREAM_INTERLEAVED)
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        // bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
+        glBindVertexArray(VAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * indexedVertices.size(), &indexedVertices[0].x, GL_STATIC_DRAW);
+        if (indexType == GL_UNSIGNED_SHORT)
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * shortIndices.size(), &shortIndices[0], GL_STATIC_DRAW);
+        else
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * longIndices.size(), &longIndices[0], GL_STATIC_DRAW);
+
+        // position attribute
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        // normal attribute
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        // baked ambient occlusion attribute
+        bindOcclusion();
+
+        // bind the vertex array
+        glBindVertexArray(0);
+    }
+
+    // 5. set up the de-interleaved position stream (half the fetch size of the interleaved layout)
+    if (streams & STREAM_POSITION)
+    {
+        std::vector<glm::vec3> positions;
+        if (stride() == 1)
+            positions = indexedVertices;
+        else
+        {
+            positions.resize(indexedVertices.size() / 2);
+            for (unsigned int i = 0; i < positions.size(); i++)
+                positions[i] = indexedVertices[i * 2];
+        }
+
+        glGenVertexArrays(1, &positionVAO);
+        glGenBuffers(1, &positionVBO);
+        glBindVertexArray(positionVAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * positions.size(), &positions[0].x, GL_STATIC_DRAW);
+
+        // the interleaved path may already have filled the element buffer
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        if (!(streams & STREAM_INTERLEAVED))
+        {
+            if (indexType == GL_UNSIGNED_SHORT)
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * shortIndices.size(), &shortIndices[0], GL_STATIC_DRAW);
+            else
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * longIndices.size(), &longIndices[0], GL_STATIC_DRAW);
+        }
+
+        // position attribute only
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+
+        glBindVertexArray(0);
+    }
 }
 
 void Mesh::render()
 {
+    if (renderTransformed())
+        return;
+    // fall back to the position stream when that is all we have
+    if (!(streams & STREAM_INTERLEAVED))
+    {
+        renderPositions();
+        return;
+    }
     glBindVertexArray(VAO); // seeing as we only have a single VAO there's no need to bind it every time, but we'll do so to keep things a bit more organized
-    glDrawArrays(GL_TRIANGLES, 0, triangles.size() * 3);
+    drawElements();
     glBindVertexArray(0); // unbind our VA no need to unbind it every time 
 }
 
+void Mesh::renderPositions()
+{
+    if (renderTransformed())
+        return;
+    // fall back to the interleaved stream (attribute 0 is the position there as well)
+    glBindVertexArray(streams & STREAM_POSITION ? positionVAO : VAO);
+    drawElements();
+    glBindVertexArray(0);
+}
+
+void Mesh::drawElements(unsigned int baseOffset)
+{
+    unsigned int indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+    for (const SubMesh& sub : submeshes)
+    {
+        void* offset = (void*)(std::size_t)(sub.firstIndex * indexSize);
+        if (sub.baseVertex + baseOffset == 0)
+            glDrawElements(GL_TRIANGLES, sub.indexCount, indexType, offset);
+        else
+            glDrawElementsBaseVertex(GL_TRIANGLES, sub.indexCount, indexType, offset, sub.baseVertex + baseOffset);
+    }
+}
+
+bool Mesh::renderTransformed()
+{
+    if (transformRegion < 0)
+        return false;
+    // regions follow each other in the buffer, so the base vertex selects one
+    glBindVertexArray(transformVAO);
+    drawElements(transformRegion * (indexedVertices.size() / stride()));
+    glBindVertexArray(0);
+    transformStream.fence(transformRegion);
+    return true;
+}
+
 void Mesh::unload()
 {
     // de-allocate all resources once they've outlived their purpose:
@@ -177,27 +503,288 @@ void Mesh::unload()
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
+    glDeleteVertexArrays(1, &positionVAO);
+    glDeleteBuffers(1, &positionVBO);
+    glDeleteVertexArrays(1, &transformVAO);
+    glDeleteBuffers(1, &occlusionVBO);
+    transformStream.destroy();
+    transformVAO = 0;
+    occlusionVBO = 0;
+    transformRegion = -1;
+}
+
+void Mesh::applyTransform(glm::mat4 transform, ThreadPool* pool)
+{
+    if (indexedVertices.empty() || EBO == 0)
+        return;
+    if (pool == NULL)
+        pool = defaultThreadPool();
+
+    // 1. de-interleave the unique vertices once so they can be transformed 4 or 8 at a time
+    unsigned int step = stride();
+    if (transformSource.count != indexedVertices.size() / step)
+        transformSource.assign(indexedVertices, step);
+
+    // 2. allocate the dynamic stream once: three regions, so the CPU writes one while the GPU
+    // may still read the two before it (regions past the first need base vertex draws)
+    std::size_t regionSize = sizeof(glm::vec3) * indexedVertices.size();
+    if (!transformStream.valid() || transformStream.regionSize != regionSize)
+    {
+        bool baseVertex = GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex;
+        if (transformVAO == 0)
+            glGenVertexArrays(1, &transformVAO);
+        glBindVertexArray(transformVAO);
+        transformStream.create(regionSize, baseVertex ? MESH_TRANSFORM_REGIONS : 1);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, step * sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(0);
+        if (step == 2)
+        {
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, step * sizeof(glm::vec3), (void*)sizeof(glm::vec3));
+            glEnableVertexAttribArray(1);
+            bindOcclusion();
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // 3. positions by the transform, normals by its normal matrix, written by the workers
+    // straight into the mapped region in cache-sized chunks (no staging copy, no upload)
+    float* out = (float*)transformStream.map();
+    if (out == NULL)
+    {
+        transformStream.unmap();
+        transformRegion = -1;
+        return;
+    }
+    auto task = [&](std::size_t first, std::size_t last)
+    {
+        transformVertices(transformSource, first, last, transform, out, step);
+    };
+    pool->parallelFor(transformSource.count, TRANSFORM_CHUNK, task);
+    transformRegion = transformStream.unmap();
+    transformVersion = 0;
+}
+
+bool Mesh::applyTransform(TransformState& state, ThreadPool* pool)
+{
+    // a region holding this version is still being drawn, nothing to compute or write
+    unsigned long long version = state.version();
+    if (transformRegion >= 0 && transformVersion == version)
+        return false;
+    applyTransform(state.model(), pool);
+    if (transformRegion < 0)
+        return false;
+    transformVersion = version;
+    return true;
 }
 
-void Mesh::applyTransform(glm::mat4 transform)
-{    
-    // for each unique vertex in the array
-    for (unsigned int i = 0; i < triangles.size() / 2; i++)
+void Mesh::resetTransform()
+{
+    // the static buffers were never touched, the dynamic stream stays allocated for next time
+    transformRegion = -1;
+}
+
+void Mesh::setOcclusion(const std::vector<unsigned char>& values)
+{
+    occlusion = values;
+    // not loaded yet: load() uploads them
+    if (VAO == 0 && transformVAO == 0)
+        return;
+    glDeleteBuffers(1, &occlusionVBO);
+    occlusionVBO = 0;
+    if (VAO != 0)
     {
-        // grab vertex and normalize it to 1
-        glm::vec4 vertex = glm::vec4(triangles.at(i*2), 1.0);
+        glBindVertexArray(VAO);
+        bindOcclusion();
+    }
+    if (transformVAO != 0 && stride() == 2)
+    {
+        glBindVertexArray(transformVAO);
+        bindOcclusion();
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-        // apply transformation to vertex
-        glm::vec4 newVertex = transform * vertex;
+void Mesh::bindOcclusion()
+{
+    if (occlusion.empty() || occlusion.size() != indexedVertices.size() / stride())
+        return;
+    // the transform stream draws region k with a base vertex of k times the vertex count, so
+    // the values are repeated once per region (one byte per vertex each)
+    if (occlusionVBO == 0)
+    {
+        std::vector<unsigned char> repeated;
+        for (unsigned int region = 0; region < MESH_TRANSFORM_REGIONS; region++)
+            repeated.insert(repeated.end(), occlusion.begin(), occlusion.end());
+        glGenBuffers(1, &occlusionVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, occlusionVBO);
+        glBufferData(GL_ARRAY_BUFFER, repeated.size(), &repeated[0], GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, occlusionVBO);
+    glVertexAttribPointer(2, 1, GL_UNSIGNED_BYTE, GL_TRUE, 1, (void*)0);
+    glEnableVertexAttribArray(2);
+}
 
-        // update the transformation container
-        transformedTriangles.at(i*2) = newVertex;
+void Mesh::generateNormals()
+{
+    if (stride() != 2)
+        return;
+
+    // 1. weld the corners by their exact position bits into unique vertices (SoA storage)
+    struct PositionHash
+    {
+        std::size_t operator()(const glm::vec3& p) const
+        {
+            uint32_t bits[3];
+            std::memcpy(bits, &p.x, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+    struct PositionEqual
+    {
+        bool operator()(const glm::vec3& a, const glm::vec3& b) const { return std::memcmp(&a.x, &b.x, sizeof(glm::vec3)) == 0; }
+    };
+    std::size_t cornerCount = triangles.size() / 2;
+    std::unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> unique;
+    unique.reserve(cornerCount);
+    std::vector<unsigned int> corners(cornerCount);
+    std::vector<glm::vec3> positions;
+    for (std::size_t c = 0; c < cornerCount; c++)
+    {
+        auto found = unique.emplace(triangles[c * 2], (unsigned int)positions.size());
+        if (found.second)
+            positions.push_back(triangles[c * 2]);
+        corners[c] = found.first->second;
+    }
+    VertexSoA vertices;
+    vertices.resize(positions.size(), true);
+    for (std::size_t v = 0; v < positions.size(); v++)
+        vertices.setPosition(v, positions[v]);
+
+    // 2. the (area-weighted) face normals summed per vertex and normalized
+    generateNormalsLayout(vertices, corners);
+    for (std::size_t c = 0; c < cornerCount; c++)
+    {
+        glm::vec3 n = vertices.normal(corners[c]);
+        triangles[c * 2 + 1] = glm::dot(n, n) > 0.0f ? n : glm::vec3(0.0, 0.0, 1.0);
+    }
+    submeshes.clear();
+}
+
+void Mesh::buildIndices(bool allowSplit, unsigned int maxRangeVertices)
+{
+    indexedVertices.clear();
+    shortIndices.clear();
+    longIndices.clear();
+    submeshes.clear();
+    transformSource.count = 0;
+
+    // 1. weld identical vertices (position and, if present, normal) into unique ids
+    unsigned int step = stride();
+    unsigned int numVerts = triangles.size() / step;
+    std::vector<unsigned int> ids(numVerts);
+    std::vector<unsigned int> firstOf; // triangles vertex that introduced each unique id
+    {
+        struct VertexHash
+        {
+            const std::vector<glm::vec3>* data;
+            unsigned int step;
+            std::size_t operator()(unsigned int v) const
+            {
+                std::size_t h = 0;
+                const unsigned int* bits = (const unsigned int*)&(*data)[v * step].x;
+                for (unsigned int k = 0; k < 3 * step; k++)
+                    h = (h ^ bits[k]) * 1099511628211ull;
+                return h;
+            }
+        };
+        struct VertexEqual
+        {
+            const std::vector<glm::vec3>* data;
+            unsigned int step;
+            bool operator()(unsigned int a, unsigned int b) const
+            {
+                return std::memcmp(&(*data)[a * step].x, &(*data)[b * step].x, sizeof(glm::vec3) * step) == 0;
+            }
+        };
+        std::unordered_map<unsigned int, unsigned int, VertexHash, VertexEqual> welded(numVerts, VertexHash{ &triangles, step }, VertexEqual{ &triangles, step });
+        for (unsigned int v = 0; v < numVerts; v++)
+        {
+            auto found = welded.emplace(v, (unsigned int)firstOf.size());
+            if (found.second)
+                firstOf.push_back(v);
+            ids[v] = found.first->second;
+        }
+    }
+
+    // 2. everything fits one 16-bit range, or splitting is not possible: a single range
+    unsigned int numUnique = firstOf.size();
+    if (numUnique <= maxRangeVertices || !allowSplit)
+    {
+        indexType = numUnique <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        indexedVertices.reserve(numUnique * step);
+        for (unsigned int v : firstOf)
+            for (unsigned int k = 0; k < step; k++)
+                indexedVertices.push_back(triangles[v * step + k]);
+        if (indexType == GL_UNSIGNED_SHORT)
+            shortIndices.assign(ids.begin(), ids.end());
+        else
+            longIndices = ids;
+        submeshes.push_back({ 0, numVerts, 0, numUnique });
+        return;
+    }
+
+    // 3. split into consecutive triangle ranges of at most maxRangeVertices unique vertices;
+    // vertices shared across a range boundary are duplicated into both ranges
+    indexType = GL_UNSIGNED_SHORT;
+    std::vector<int> local(numUnique, -1);
+    std::vector<unsigned int> rangeVerts;
+    SubMesh sub = { 0, 0, 0, 0 };
+
+    auto closeRange = [&]()
+    {
+        for (unsigned int id : rangeVerts)
+        {
+            local[id] = -1;
+            for (unsigned int k = 0; k < step; k++)
+                indexedVertices.push_back(triangles[firstOf[id] * step + k]);
+        }
+        sub.vertexCount = rangeVerts.size();
+        submeshes.push_back(sub);
+        sub.firstIndex += sub.indexCount;
+        sub.indexCount = 0;
+        sub.baseVertex += sub.vertexCount;
+        rangeVerts.clear();
+    };
+
+    shortIndices.reserve(numVerts);
+    for (unsigned int t = 0; t + 2 < numVerts; t += 3)
+    {
+        // count the vertices this triangle would add to the current range
+        unsigned int a = ids[t], b = ids[t + 1], c = ids[t + 2];
+        unsigned int added = (local[a] < 0) + (local[b] < 0 && b != a) + (local[c] < 0 && c != a && c != b);
+        if (rangeVerts.size() + added > maxRangeVertices)
+            closeRange();
+
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            unsigned int id = ids[t + k];
+            if (local[id] < 0)
+            {
+                local[id] = rangeVerts.size();
+                rangeVerts.push_back(id);
+            }
+            shortIndices.push_back((unsigned short)local[id]);
+        }
+        sub.indexCount += 3;
     }
-    // reload VBO and VAO for re-rendering
-    load();
+    if (sub.indexCount > 0)
+        closeRange();
 }
 
-void Mesh::triangulate(std::vector<int> vertIndices, std::vector<int> normIndices, std::vector<glm::ivec3>& faces)
+void Mesh::triangulate(const std::vector<int>& vertIndices, const std::vector<int>& normIndices, std::vector<glm::ivec3>& faces)
 {
     glm::ivec3 face;
     glm::ivec3 prevFace;
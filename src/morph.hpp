@@ -0,0 +1,264 @@
+#ifndef MORPH_H
+#define MORPH_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+#include "transform.hpp"
+#include "threadpool.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// vertices per work item when a blend is split across threads
+const std::size_t MORPH_CHUNK = 4096;
+// unchanged vertices between two changed ones that are stored as zero deltas rather than
+// starting a new span, so the spans stay long enough for the vector loops
+const unsigned int MORPH_SPAN_GAP = 8;
+
+// a run of consecutive vertices moved by a target: vertices [first, first + count) take the
+// deltas [offset, offset + count) of the target
+struct MorphSpan
+{
+    unsigned int first;
+    unsigned int count;
+    unsigned int offset;
+};
+
+// one blend shape, stored as deltas from the base for only the vertices it moves
+struct MorphTarget
+{
+    std::string name;
+    std::vector<MorphSpan> spans;   // sorted by first vertex
+    VertexSoA deltas;               // position (and normal) deltas of the spans, back to back
+};
+
+// blend shapes of one mesh: the targets are meshes with the same topology (same faces in the
+// same order) as the base, and any weighted sum of them is evaluated on the CPU and streamed
+// through the mesh's dynamic vertex buffer (see Mesh::applyTransform)
+class MorphSet
+{
+public:
+    VertexSoA base; // the base mesh's indexed vertices
+    std::vector<MorphTarget> targets;
+
+    // the base has to be parsed from its .obj (triangles present) and indexed without the
+    // vertex cache reordering of asset packs, so each vertex can be traced back to a corner
+    bool setBase(const Mesh& mesh);
+    // adds a target with the base's topology; deltas shorter than epsilon are not stored
+    bool addTarget(const Mesh& target, const std::string& name, float epsilon = 1e-6f);
+    // deltas stored over all targets (including the zeros bridging gaps)
+    std::size_t deltaCount() const;
+
+    // base + sum of weights[t] * target t, written to out; targets with a zero weight cost
+    // nothing, the rest are split over the pool (the default one when NULL)
+    void evaluate(const std::vector<float>& weights, VertexSoA& out, ThreadPool* pool = NULL) const;
+    // evaluates into the mesh's transform source and streams it with the given transform
+    void apply(Mesh& mesh, const std::vector<float>& weights, const glm::mat4& transform, ThreadPool* pool = NULL) const;
+private:
+    std::vector<unsigned int> firstCorner; // the triangles corner that introduced each vertex
+    unsigned int cornerCount = 0;
+    unsigned int stride = 1;
+    // blends vertices [first, last) into out
+    void evaluateRange(const std::vector<float>& weights, VertexSoA& out, std::size_t first, std::size_t last) const;
+};
+
+// out[i] += weight * delta[i] for i in [0, count); uses AVX2, SSE or scalar code depending on the CPU
+void morphAccumulate(float* out, const float* delta, float weight, std::size_t count);
+
+#ifdef TRANSFORM_X86
+__attribute__((target("avx2,fma")))
+void morphAccumulateAVX2(float* out, const float* delta, float weight, std::size_t& i, std::size_t count)
+{
+    __m256 w = _mm256_set1_ps(weight);
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(w, _mm256_loadu_ps(delta + i), _mm256_loadu_ps(out + i)));
+}
+
+void morphAccumulateSSE(float* out, const float* delta, float weight, std::size_t& i, std::size_t count)
+{
+    __m128 w = _mm_set1_ps(weight);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(w, _mm_loadu_ps(delta + i))));
+}
+#endif
+
+void morphAccumulate(float* out, const float* delta, float weight, std::size_t count)
+{
+    std::size_t i = 0;
+#ifdef TRANSFORM_X86
+    if (transformHasAVX2())
+        morphAccumulateAVX2(out, delta, weight, i, count);
+    morphAccumulateSSE(out, delta, weight, i, count);
+#endif
+    for (; i < count; i++)
+        out[i] += weight * delta[i];
+}
+
+bool MorphSet::setBase(const Mesh& mesh)
+{
+    targets.clear();
+    firstCorner.clear();
+    cornerCount = 0;
+    stride = mesh.stride();
+    unsigned int numCorners = mesh.triangles.size() / stride;
+    unsigned int numUnique = mesh.indexedVertices.size() / stride;
+    unsigned int numIndices = mesh.indexType == GL_UNSIGNED_SHORT ? mesh.shortIndices.size() : mesh.longIndices.size();
+    if (numCorners == 0 || numIndices != numCorners)
+    {
+        std::cout << "ERROR::MORPH::BASE_NOT_INDEXED_FROM_TRIANGLES" << std::endl;
+        return false;
+    }
+
+    // 1. the index buffer lists the corners in triangles order, so corner c is vertex
+    // index[c] + baseVertex of the submesh holding it
+    firstCorner.assign(numUnique, numCorners);
+    for (const SubMesh& sub : mesh.submeshes)
+    {
+        for (unsigned int c = sub.firstIndex; c < sub.firstIndex + sub.indexCount; c++)
+        {
+            unsigned int v = (mesh.indexType == GL_UNSIGNED_SHORT ? mesh.shortIndices[c] : mesh.longIndices[c]) + sub.baseVertex;
+            if (v < numUnique && firstCorner[v] == numCorners)
+                firstCorner[v] = c;
+        }
+    }
+
+    // 2. the blend starts from a de-interleaved copy of the vertices
+    cornerCount = numCorners;
+    base.assign(mesh.indexedVertices, stride);
+    return true;
+}
+
+bool MorphSet::addTarget(const Mesh& target, const std::string& name, float epsilon)
+{
+    if (cornerCount == 0 || target.stride() != stride || target.triangles.size() / stride != cornerCount)
+    {
+        std::cout << "ERROR::MORPH::TOPOLOGY_MISMATCH::" << name << std::endl;
+        return false;
+    }
+
+    // 1. sample the target at the corner behind each base vertex
+    bool normals = stride == 2;
+    std::vector<glm::vec3> dp(base.count), dn(normals ? base.count : 0);
+    std::vector<char> moved(base.count, 0);
+    for (std::size_t v = 0; v < base.count; v++)
+    {
+        unsigned int c = firstCorner[v];
+        dp[v] = target.triangles[c * stride] - base.position(v);
+        if (normals)
+            dn[v] = target.triangles[c * stride + 1] - base.normal(v);
+        float change = std::max(glm::length(dp[v]), normals ? glm::length(dn[v]) : 0.0f);
+        moved[v] = change > epsilon;
+    }
+
+    // 2. gather the moved vertices into spans, bridging short gaps
+    MorphTarget morph;
+    morph.name = name;
+    std::vector<unsigned int> stored;
+    for (unsigned int v = 0; v < base.count; v++)
+    {
+        if (!moved[v])
+            continue;
+        MorphSpan* last = morph.spans.empty() ? NULL : &morph.spans.back();
+        if (last != NULL && v - (last->first + last->count) <= MORPH_SPAN_GAP)
+        {
+            for (unsigned int u = last->first + last->count; u <= v; u++)
+                stored.push_back(u);
+            last->count = v + 1 - last->first;
+        }
+        else
+        {
+            morph.spans.push_back(MorphSpan{ v, 1, (unsigned int)stored.size() });
+            stored.push_back(v);
+        }
+    }
+    morph.deltas.resize(stored.size(), normals);
+    for (std::size_t i = 0; i < stored.size(); i++)
+    {
+        morph.deltas.setPosition(i, moved[stored[i]] ? dp[stored[i]] : glm::vec3(0.0f));
+        if (normals)
+            morph.deltas.setNormal(i, moved[stored[i]] ? dn[stored[i]] : glm::vec3(0.0f));
+    }
+    targets.push_back(morph);
+    return true;
+}
+
+std::size_t MorphSet::deltaCount() const
+{
+    std::size_t count = 0;
+    for (const MorphTarget& target : targets)
+        count += target.deltas.count;
+    return count;
+}
+
+void MorphSet::evaluateRange(const std::vector<float>& weights, VertexSoA& out, std::size_t first, std::size_t last) const
+{
+    // 1. start from the base
+    bool normals = base.hasNormals();
+    std::copy(base.px.begin() + first, base.px.begin() + last, out.px.begin() + first);
+    std::copy(base.py.begin() + first, base.py.begin() + last, out.py.begin() + first);
+    std::copy(base.pz.begin() + first, base.pz.begin() + last, out.pz.begin() + first);
+    if (normals)
+    {
+        std::copy(base.nx.begin() + first, base.nx.begin() + last, out.nx.begin() + first);
+        std::copy(base.ny.begin() + first, base.ny.begin() + last, out.ny.begin() + first);
+        std::copy(base.nz.begin() + first, base.nz.begin() + last, out.nz.begin() + first);
+    }
+
+    // 2. add every weighted target over the part of its spans inside the range
+    for (std::size_t t = 0; t < targets.size() && t < weights.size(); t++)
+    {
+        float weight = weights[t];
+        if (weight == 0.0f)
+            continue;
+        const MorphTarget& target = targets[t];
+        const VertexSoA& d = target.deltas;
+        auto span = std::lower_bound(target.spans.begin(), target.spans.end(), first,
+                                     [](const MorphSpan& s, std::size_t v) { return s.first + s.count <= v; });
+        for (; span != target.spans.end() && span->first < last; ++span)
+        {
+            std::size_t from = std::max<std::size_t>(span->first, first);
+            std::size_t to = std::min<std::size_t>(span->first + span->count, last);
+            std::size_t at = span->offset + (from - span->first);
+            std::size_t count = to - from;
+            morphAccumulate(&out.px[from], &d.px[at], weight, count);
+            morphAccumulate(&out.py[from], &d.py[at], weight, count);
+            morphAccumulate(&out.pz[from], &d.pz[at], weight, count);
+            if (normals)
+            {
+                morphAccumulate(&out.nx[from], &d.nx[at], weight, count);
+                morphAccumulate(&out.ny[from], &d.ny[at], weight, count);
+                morphAccumulate(&out.nz[from], &d.nz[at], weight, count);
+            }
+        }
+    }
+}
+
+void MorphSet::evaluate(const std::vector<float>& weights, VertexSoA& out, ThreadPool* pool) const
+{
+    if (pool == NULL)
+        pool = defaultThreadPool();
+    if (out.count != base.count || out.hasNormals() != base.hasNormals())
+        out.resize(base.count, base.hasNormals());
+    auto task = [&](std::size_t first, std::size_t last)
+    {
+        evaluateRange(weights, out, first, last);
+    };
+    pool->parallelFor(base.count, MORPH_CHUNK, task);
+}
+
+void MorphSet::apply(Mesh& mesh, const std::vector<float>& weights, const glm::mat4& transform, ThreadPool* pool) const
+{
+    if (mesh.indexedVertices.size() / mesh.stride() != base.count)
+        return;
+    // applyTransform keeps a transform source of the right size, so it streams the blend
+    evaluate(weights, mesh.transformSource, pool);
+    mesh.applyTransform(transform, pool);
+}
+
+#endif
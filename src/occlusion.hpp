@@ -0,0 +1,301 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+#include "progressive.hpp"
+#include "transform.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// the depth buffer is kept at full (low) resolution plus one level of 8x4 pixel tiles holding
+// the farthest depth in each, so an occludee is rejected tile by tile and only tiles it may
+// poke through are looked at per pixel
+const int OCCLUSION_TILE_WIDTH = 8;
+const int OCCLUSION_TILE_HEIGHT = 4;
+
+// a reduced copy of a mesh to rasterize as an occluder
+struct OccluderMesh
+{
+    std::vector<glm::vec3> positions;
+    std::vector<glm::uvec3> faces;
+};
+
+// CPU occlusion culling: each frame a few large occluders are rasterized (depth only, 8 pixels
+// at a time) into a small depth buffer, and the bounding boxes of the other objects are tested
+// against it before their draws are issued
+class OcclusionCuller
+{
+public:
+    int width, height;          // multiples of the tile size
+    std::vector<float> depth;   // window depth of the nearest occluder per pixel (1 where none), bottom row first
+    std::vector<float> tileMax; // the farthest depth of each tile
+
+    OcclusionCuller(int width = 256, int height = 192);
+    // simplifies the mesh (quadric error collapses, see ProgressiveMesh) to about maxTriangles
+    static OccluderMesh makeOccluder(const Mesh& mesh, unsigned int maxTriangles = 1024);
+
+    void clear();
+    void rasterize(const OccluderMesh& occluder, const glm::mat4& modelViewProjection);
+    // builds the tile level, call after the last occluder and before the tests
+    void finish();
+    // whether any part of the box may be in front of the occluders (boxes crossing the near
+    // plane always are, boxes entirely outside the view never are)
+    bool visible(const glm::vec3& lower, const glm::vec3& upper, const glm::mat4& modelViewProjection) const;
+private:
+    int tilesX, tilesY;
+    // window coordinates (x, y in pixels, z in [0, 1]) of a clip space position
+    glm::vec3 toWindow(const glm::vec4& clip) const;
+    void rasterizeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+};
+
+// writes the depth of 8 pixels starting at x where they are covered and nearer
+void occlusionSpanScalar(float* row, int x, int last, const float edge[3], const float stepX[3], float z, float dzdx);
+#ifdef TRANSFORM_X86
+__attribute__((target("avx2,fma")))
+void occlusionSpanAVX2(float* row, int x, int last, const float edge[3], const float stepX[3], float z, float dzdx);
+#endif
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    tilesX = width / OCCLUSION_TILE_WIDTH;
+    tilesY = height / OCCLUSION_TILE_HEIGHT;
+    depth.resize(width * height);
+    tileMax.resize(tilesX * tilesY);
+    clear();
+}
+
+OccluderMesh OcclusionCuller::makeOccluder(const Mesh& mesh, unsigned int maxTriangles)
+{
+    // 1. the simplifier reads a triangle soup; indexed-only meshes (asset packs) are expanded
+    Mesh soup;
+    const Mesh* source = &mesh;
+    if (mesh.triangles.empty())
+    {
+        soup.attributes = mesh.attributes;
+        unsigned int step = mesh.stride();
+        for (const SubMesh& sub : mesh.submeshes)
+            for (unsigned int k = sub.firstIndex; k < sub.firstIndex + sub.indexCount; k++)
+            {
+                unsigned int v = (mesh.indexType == GL_UNSIGNED_SHORT ? mesh.shortIndices[k] : mesh.longIndices[k]) + sub.baseVertex;
+                for (unsigned int c = 0; c < step; c++)
+                    soup.triangles.push_back(mesh.indexedVertices[v * step + c]);
+            }
+        source = &soup;
+    }
+
+    // 2. the base mesh of the progressive mesh is the simplified occluder
+    ProgressiveMesh pm;
+    pm.build(*source, std::max(1u, maxTriangles));
+    OccluderMesh occluder;
+    occluder.positions.resize(pm.baseVertices.size() / 2);
+    for (std::size_t i = 0; i < occluder.positions.size(); i++)
+        occluder.positions[i] = pm.baseVertices[i * 2];
+    occluder.faces = pm.baseFaces;
+    return occluder;
+}
+
+void OcclusionCuller::clear()
+{
+    std::fill(depth.begin(), depth.end(), 1.0f);
+    std::fill(tileMax.begin(), tileMax.end(), 1.0f);
+}
+
+glm::vec3 OcclusionCuller::toWindow(const glm::vec4& clip) const
+{
+    float invW = 1.0f / clip.w;
+    return glm::vec3((clip.x * invW * 0.5f + 0.5f) * width, (clip.y * invW * 0.5f + 0.5f) * height, clip.z * invW * 0.5f + 0.5f);
+}
+
+void OcclusionCuller::rasterize(const OccluderMesh& occluder, const glm::mat4& modelViewProjection)
+{
+    std::vector<glm::vec4> clip(occluder.positions.size());
+    for (std::size_t i = 0; i < clip.size(); i++)
+        clip[i] = modelViewProjection * glm::vec4(occluder.positions[i], 1.0f);
+
+    for (const glm::uvec3& face : occluder.faces)
+    {
+        const glm::vec4& a = clip[face.x];
+        const glm::vec4& b = clip[face.y];
+        const glm::vec4& c = clip[face.z];
+        // triangles reaching behind the near plane are left out, an occluder may only ever
+        // hide less than it covers
+        if (a.z < -a.w || b.z < -b.w || c.z < -c.w)
+            continue;
+        rasterizeTriangle(toWindow(a), toWindow(b), toWindow(c));
+    }
+}
+
+void OcclusionCuller::rasterizeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    // 1. counter-clockwise, with edge e opposite corner e
+    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (!(std::abs(area) > 0.0f))
+        return;
+    glm::vec3 p[3] = { a, area > 0.0f ? b : c, area > 0.0f ? c : b };
+    area = std::abs(area);
+
+    // 2. the pixel centers the bounds can cover
+    int minX = std::max(0, (int)std::ceil(std::min(std::min(p[0].x, p[1].x), p[2].x) - 0.5f));
+    int minY = std::max(0, (int)std::ceil(std::min(std::min(p[0].y, p[1].y), p[2].y) - 0.5f));
+    int maxX = std::min(width - 1, (int)std::floor(std::max(std::max(p[0].x, p[1].x), p[2].x) - 0.5f));
+    int maxY = std::min(height - 1, (int)std::floor(std::max(std::max(p[0].y, p[1].y), p[2].y) - 0.5f));
+    if (minX > maxX || minY > maxY)
+        return;
+
+    // 3. edge functions and the depth plane, stepped per pixel
+    float stepX[3], stepY[3], rowStart[3];
+    int startX = minX & ~(OCCLUSION_TILE_WIDTH - 1);
+    for (int e = 0; e < 3; e++)
+    {
+        const glm::vec3& u = p[(e + 1) % 3];
+        const glm::vec3& v = p[(e + 2) % 3];
+        stepX[e] = -(v.y - u.y);
+        stepY[e] = v.x - u.x;
+        rowStart[e] = (v.x - u.x) * (minY + 0.5f - u.y) - (v.y - u.y) * (startX + 0.5f - u.x);
+    }
+    float dzdx = (stepX[0] * p[0].z + stepX[1] * p[1].z + stepX[2] * p[2].z) / area;
+    float dzdy = (stepY[0] * p[0].z + stepY[1] * p[1].z + stepY[2] * p[2].z) / area;
+    float zRow = (rowStart[0] * p[0].z + rowStart[1] * p[1].z + rowStart[2] * p[2].z) / area;
+
+    // 4. 8 pixel spans, aligned like the tiles
+#ifdef TRANSFORM_X86
+    bool avx2 = transformHasAVX2();
+#endif
+    for (int y = minY; y <= maxY; y++)
+    {
+        float* row = &depth[y * width];
+        float edge[3] = { rowStart[0], rowStart[1], rowStart[2] };
+        float z = zRow;
+        for (int x = startX; x <= maxX; x += OCCLUSION_TILE_WIDTH)
+        {
+#ifdef TRANSFORM_X86
+            if (avx2)
+                occlusionSpanAVX2(row, x, maxX, edge, stepX, z, dzdx);
+            else
+#endif
+                occlusionSpanScalar(row, x, maxX, edge, stepX, z, dzdx);
+            for (int e = 0; e < 3; e++)
+                edge[e] += stepX[e] * OCCLUSION_TILE_WIDTH;
+            z += dzdx * OCCLUSION_TILE_WIDTH;
+        }
+        for (int e = 0; e < 3; e++)
+            rowStart[e] += stepY[e];
+        zRow += dzdy;
+    }
+}
+
+void occlusionSpanScalar(float* row, int x, int last, const float edge[3], const float stepX[3], float z, float dzdx)
+{
+    for (int i = 0; i < OCCLUSION_TILE_WIDTH && x + i <= last; i++)
+    {
+        bool covered = edge[0] + stepX[0] * i >= 0.0f && edge[1] + stepX[1] * i >= 0.0f && edge[2] + stepX[2] * i >= 0.0f;
+        float pixelZ = z + dzdx * i;
+        if (covered && pixelZ >= 0.0f && pixelZ < row[x + i])
+            row[x + i] = pixelZ;
+    }
+}
+
+#ifdef TRANSFORM_X86
+__attribute__((target("avx2,fma")))
+void occlusionSpanAVX2(float* row, int x, int last, const float edge[3], const float stepX[3], float z, float dzdx)
+{
+    // the coverage of the 8 pixels as one mask: inside all three edges, in front of the near
+    // plane, nearer than what is there, and not past the end of the row
+    __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    __m256 zero = _mm256_setzero_ps();
+    __m256 mask = _mm256_cmp_ps(lane, _mm256_set1_ps((float)(last - x)), _CMP_LE_OQ);
+    for (int e = 0; e < 3; e++)
+    {
+        __m256 value = _mm256_fmadd_ps(lane, _mm256_set1_ps(stepX[e]), _mm256_set1_ps(edge[e]));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(value, zero, _CMP_GE_OQ));
+    }
+    if (_mm256_movemask_ps(mask) == 0)
+        return;
+    __m256 pixelZ = _mm256_fmadd_ps(lane, _mm256_set1_ps(dzdx), _mm256_set1_ps(z));
+    __m256 stored = _mm256_loadu_ps(row + x);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(pixelZ, zero, _CMP_GE_OQ));
+    _mm256_storeu_ps(row + x, _mm256_blendv_ps(stored, _mm256_min_ps(stored, pixelZ), mask));
+}
+#endif
+
+void OcclusionCuller::finish()
+{
+    // 1. the occluders were sampled at pixel centers, so a pixel counts as hidden only when its
+    // neighbours are too: the farthest depth of each 3x3 neighbourhood (separably, rows then
+    // columns) keeps the buffer from hiding more than the occluders do at full resolution
+    std::vector<float> rows(depth.size());
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            const float* row = &depth[y * width];
+            rows[y * width + x] = std::max(row[x], std::max(row[std::max(x - 1, 0)], row[std::min(x + 1, width - 1)]));
+        }
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            float below = rows[std::max(y - 1, 0) * width + x], above = rows[std::min(y + 1, height - 1) * width + x];
+            depth[y * width + x] = std::max(rows[y * width + x], std::max(below, above));
+        }
+
+    // 2. the farthest depth of each tile
+    for (int ty = 0; ty < tilesY; ty++)
+        for (int tx = 0; tx < tilesX; tx++)
+        {
+            float farthest = 0.0f;
+            for (int y = ty * OCCLUSION_TILE_HEIGHT; y < (ty + 1) * OCCLUSION_TILE_HEIGHT; y++)
+            {
+                const float* row = &depth[y * width + tx * OCCLUSION_TILE_WIDTH];
+                for (int x = 0; x < OCCLUSION_TILE_WIDTH; x++)
+                    farthest = std::max(farthest, row[x]);
+            }
+            tileMax[ty * tilesX + tx] = farthest;
+        }
+}
+
+bool OcclusionCuller::visible(const glm::vec3& lower, const glm::vec3& upper, const glm::mat4& modelViewProjection) const
+{
+    // 1. the window space rectangle and nearest depth of the box
+    glm::vec3 windowLower(std::numeric_limits<float>::max()), windowUpper(-std::numeric_limits<float>::max());
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec3 p(corner & 1 ? upper.x : lower.x, corner & 2 ? upper.y : lower.y, corner & 4 ? upper.z : lower.z);
+        glm::vec4 clip = modelViewProjection * glm::vec4(p, 1.0f);
+        if (clip.z < -clip.w || clip.w <= 0.0f)
+            return true;
+        glm::vec3 window = toWindow(clip);
+        windowLower = glm::min(windowLower, window);
+        windowUpper = glm::max(windowUpper, window);
+    }
+    if (windowUpper.x < 0.0f || windowUpper.y < 0.0f || windowLower.x > width || windowLower.y > height || windowLower.z > 1.0f)
+        return false;
+
+    // 2. every pixel the rectangle touches, tile by tile: a tile whose farthest occluder is in
+    // front of the box hides its part of the box entirely
+    int x0 = std::max(0, (int)std::floor(windowLower.x)), x1 = std::min(width - 1, (int)std::floor(windowUpper.x));
+    int y0 = std::max(0, (int)std::floor(windowLower.y)), y1 = std::min(height - 1, (int)std::floor(windowUpper.y));
+    float nearest = windowLower.z;
+    for (int ty = y0 / OCCLUSION_TILE_HEIGHT; ty <= y1 / OCCLUSION_TILE_HEIGHT; ty++)
+    {
+        for (int tx = x0 / OCCLUSION_TILE_WIDTH; tx <= x1 / OCCLUSION_TILE_WIDTH; tx++)
+        {
+            if (tileMax[ty * tilesX + tx] <= nearest)
+                continue;
+            int fromY = std::max(y0, ty * OCCLUSION_TILE_HEIGHT), toY = std::min(y1, (ty + 1) * OCCLUSION_TILE_HEIGHT - 1);
+            int fromX = std::max(x0, tx * OCCLUSION_TILE_WIDTH), toX = std::min(x1, (tx + 1) * OCCLUSION_TILE_WIDTH - 1);
+            for (int y = fromY; y <= toY; y++)
+                for (int x = fromX; x <= toX; x++)
+                    if (depth[y * width + x] > nearest)
+                        return true;
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// reorders a triangle list for the post-transform vertex cache, after Tom Forsyth's
+// "Linear-Speed Vertex Cache Optimisation": triangles are emitted greedily by the summed
+// score of their vertices, which favours vertices that were used recently and vertices
+// with few remaining triangles (so they leave the working set quickly)
+void optimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertexCount)
+{
+    const int cacheSize = 32;
+    unsigned int numTriangles = indices.size() / 3;
+    if (numTriangles == 0)
+        return;
+
+    auto score = [](int cachePos, unsigned int remaining)
+    {
+        if (remaining == 0)
+            return -1.0f;
+        float s = 0.0f;
+        if (cachePos >= 0)
+        {
+            // the last triangle's vertices get a fixed score so it is not simply repeated
+            if (cachePos < 3)
+                s = 0.75f;
+            else
+                s = std::pow(1.0f - float(cachePos - 3) / float(cacheSize - 3), 1.5f);
+        }
+        // boost vertices with few triangles left
+        return s + 2.0f / std::sqrt((float)remaining);
+    };
+
+    // 1. vertex -> triangle adjacency
+    std::vector<unsigned int> remaining(vertexCount, 0);
+    for (unsigned int idx : indices)
+        remaining[idx]++;
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (unsigned int v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (unsigned int t = 0; t < numTriangles; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[fill[indices[t * 3 + k]]++] = t;
+
+    std::vector<float> vertexScore(vertexCount);
+    for (unsigned int v = 0; v < vertexCount; v++)
+        vertexScore[v] = score(-1, remaining[v]);
+    std::vector<bool> emitted(numTriangles, false);
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    std::vector<unsigned int> cache, newCache;
+    unsigned int scan = 0;
+    int best = -1;
+
+    // 2. greedy emission
+    for (unsigned int step = 0; step < numTriangles; step++)
+    {
+        if (best < 0)
+        {
+            // nothing useful in the cache, take the next unemitted triangle in input order
+            while (emitted[scan])
+                scan++;
+            best = scan;
+        }
+        emitted[best] = true;
+        unsigned int tri[3] = { indices[best * 3], indices[best * 3 + 1], indices[best * 3 + 2] };
+        output.insert(output.end(), tri, tri + 3);
+
+        // remove the triangle from its vertices' remaining lists
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = tri[k];
+            unsigned int* begin = &adjacency[offsets[v]];
+            unsigned int* end = begin + remaining[v];
+            std::iter_swap(std::find(begin, end, (unsigned int)best), end - 1);
+            remaining[v]--;
+        }
+
+        // move the triangle's vertices to the front of the LRU cache
+        newCache.assign(tri, tri + 3);
+        for (unsigned int v : cache)
+            if (v != tri[0] && v != tri[1] && v != tri[2])
+                newCache.push_back(v);
+        for (std::size_t i = cacheSize; i < newCache.size(); i++)
+            vertexScore[newCache[i]] = score(-1, remaining[newCache[i]]);
+        if (newCache.size() > (std::size_t)cacheSize)
+            newCache.resize(cacheSize);
+        cache.swap(newCache);
+
+        // rescore the cached vertices and their triangles, remembering the best one
+        for (std::size_t i = 0; i < cache.size(); i++)
+            vertexScore[cache[i]] = score(i, remaining[cache[i]]);
+        best = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : cache)
+        {
+            for (unsigned int a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+            {
+                unsigned int t = adjacency[a];
+                float s = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                if (s > bestScore)
+                {
+                    bestScore = s;
+                    best = t;
+                }
+            }
+        }
+    }
+    indices.swap(output);
+}
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "mesh.hpp"
+#include "iosystem.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+// asset pack: every asset of a directory compiled into one file that is mapped once.
+// Layout (offsets from the start of the file, every section 64-byte aligned):
+//   PackHeader | PackEntry[entryCount] (sorted by name) | names | blobs...
+// Mesh blobs hold a PackMeshHeader followed by the submeshes, the indexed vertices and the
+// indices exactly as Mesh::load() uploads them; raw blobs are the source file's bytes.
+
+const uint32_t PACK_VERSION = 1;
+const uint64_t PACK_ALIGNMENT = 64;
+
+enum PackKind
+{
+    PACK_RAW = 0,
+    PACK_MESH = 1
+};
+
+struct PackHeader
+{
+    char magic[4];          // "VTPK"
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+    uint64_t entriesOffset;
+    uint64_t namesOffset;
+    uint64_t fileSize;
+};
+
+struct PackEntry
+{
+    uint64_t hash;          // content hash of the source file (for incremental builds)
+    uint64_t offset;
+    uint64_t size;
+    uint32_t nameOffset;    // into the names section
+    uint32_t nameLength;
+    uint32_t kind;          // PackKind
+    uint32_t reserved;
+};
+
+struct PackMeshHeader
+{
+    uint32_t attributes;
+    uint32_t indexType;
+    uint32_t vertexCount;   // in vec3s, i.e. unique vertices * stride
+    uint32_t indexCount;
+    uint32_t submeshCount;
+    float largestVertex[3];
+    uint64_t submeshOffset; // offsets from the start of the blob
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+};
+
+// 64-bit FNV-1a, seeded with the pack version so a format change invalidates old entries
+uint64_t packHash(const char* data, std::size_t size)
+{
+    uint64_t hash = 14695981039346656037ull ^ PACK_VERSION;
+    for (std::size_t i = 0; i < size; i++)
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+    return hash;
+}
+
+// read-only view of a mapped pack; raw entries are also served through the IOSystem interface
+class AssetPack : public IOSystem
+{
+public:
+    AssetPack(const char* packPath, IOSystem* base = NULL);
+    ~AssetPack();
+    bool valid() const { return header != NULL; }
+
+    std::size_t count() const { return header ? header->entryCount : 0; }
+    const PackEntry& entry(std::size_t i) const { return entries[i]; }
+    std::string name(const PackEntry& e) const { return std::string(names + e.nameOffset, e.nameLength); }
+    const char* blob(const PackEntry& e) const { return bytes + e.offset; }
+    const PackEntry* find(const char* name) const;
+
+    // fills a Mesh straight from the pack (no parsing, the data only needs to be copied)
+    bool loadMesh(const char* name, Mesh& mesh) const;
+
+    bool exists(const char* path) const override;
+    IOStream* open(const char* path) override;
+private:
+    IOSystem* base;
+    IOStream* file;
+    const char* bytes;
+    const PackHeader* header;
+    const PackEntry* entries;
+    const char* names;
+};
+
+// collects blobs and writes a pack
+class PackBuilder
+{
+public:
+    void add(const std::string& name, uint64_t hash, PackKind kind, std::vector<char>&& blob);
+    // lays out a Mesh (indexed, see Mesh::buildIndices) as a mesh blob
+    static std::vector<char> serializeMesh(const Mesh& mesh);
+    bool write(const char* packPath);
+private:
+    struct Item
+    {
+        std::string name;
+        uint64_t hash;
+        PackKind kind;
+        std::vector<char> blob;
+    };
+    std::vector<Item> items;
+};
+
+AssetPack::AssetPack(const char* packPath, IOSystem* base)
+{
+    static MMapIOSystem mapped;
+    this->base = base ? base : &mapped;
+    bytes = NULL;
+    header = NULL;
+    entries = NULL;
+    names = NULL;
+    file = this->base->open(packPath);
+    if (file == NULL)
+        return;
+    if (file->data() == NULL || file->fileSize() < sizeof(PackHeader))
+    {
+        std::cout << "ERROR::PACK::NOT_MAPPABLE" << std::endl;
+        return;
+    }
+
+    bytes = file->data();
+    const PackHeader* h = (const PackHeader*)bytes;
+    if (std::memcmp(h->magic, "VTPK", 4) != 0 || h->version != PACK_VERSION || h->fileSize != file->fileSize() ||
+        h->entriesOffset + sizeof(PackEntry) * h->entryCount > h->fileSize)
+    {
+        std::cout << "ERROR::PACK::INVALID_PACK" << std::endl;
+        return;
+    }
+    header = h;
+    entries = (const PackEntry*)(bytes + h->entriesOffset);
+    names = bytes + h->namesOffset;
+}
+
+AssetPack::~AssetPack()
+{
+    if (file)
+        base->close(file);
+}
+
+const PackEntry* AssetPack::find(const char* name) const
+{
+    // entries are sorted by name
+    std::size_t length = std::strlen(name);
+    std::size_t low = 0, high = count();
+    while (low < high)
+    {
+        std::size_t mid = (low + high) / 2;
+        const PackEntry& e = entries[mid];
+        int cmp = std::memcmp(names + e.nameOffset, name, std::min<std::size_t>(e.nameLength, length));
+        if (cmp == 0)
+            cmp = e.nameLength < length ? -1 : e.nameLength > length ? 1 : 0;
+        if (cmp == 0)
+            return &e;
+        if (cmp < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return NULL;
+}
+
+bool AssetPack::loadMesh(const char* name, Mesh& mesh) const
+{
+    const PackEntry* e = find(name);
+    if (e == NULL || e->kind != PACK_MESH)
+        return false;
+    const char* data = blob(*e);
+    const PackMeshHeader* h = (const PackMeshHeader*)data;
+
+    mesh = Mesh();
+    mesh.attributes = h->attributes;
+    mesh.indexType = h->indexType;
+    mesh.largestVertex = glm::vec3(h->largestVertex[0], h->largestVertex[1], h->largestVertex[2]);
+    const SubMesh* submeshes = (const SubMesh*)(data + h->submeshOffset);
+    const glm::vec3* vertices = (const glm::vec3*)(data + h->vertexOffset);
+    mesh.submeshes.assign(submeshes, submeshes + h->submeshCount);
+    mesh.indexedVertices.assign(vertices, vertices + h->vertexCount);
+    if (h->indexType == GL_UNSIGNED_SHORT)
+    {
+        const unsigned short* indices = (const unsigned short*)(data + h->indexOffset);
+        mesh.shortIndices.assign(indices, indices + h->indexCount);
+    }
+    else
+    {
+        const unsigned int* indices = (const unsigned int*)(data + h->indexOffset);
+        mesh.longIndices.assign(indices, indices + h->indexCount);
+    }
+
+    // expand the triangle list for the CPU-side code paths
+    unsigned int step = mesh.stride();
+    mesh.triangles.reserve(h->indexCount * step);
+    for (const SubMesh& sub : mesh.submeshes)
+    {
+        for (unsigned int i = sub.firstIndex; i < sub.firstIndex + sub.indexCount; i++)
+        {
+            unsigned int v = sub.baseVertex + (h->indexType == GL_UNSIGNED_SHORT ? mesh.shortIndices[i] : mesh.longIndices[i]);
+            for (unsigned int k = 0; k < step; k++)
+                mesh.triangles.push_back(vertices[v * step + k]);
+        }
+    }
+    return true;
+}
+
+bool AssetPack::exists(const char* path) const
+{
+    return find(path) != NULL;
+}
+
+IOStream* AssetPack::open(const char* path)
+{
+    const PackEntry* e = find(path);
+    if (e == NULL || e->kind != PACK_RAW)
+        return NULL;
+    return new MemoryIOStream(blob(*e), e->size);
+}
+
+void PackBuilder::add(const std::string& name, uint64_t hash, PackKind kind, std::vector<char>&& blob)
+{
+    items.push_back({ name, hash, kind, std::move(blob) });
+}
+
+std::vector<char> PackBuilder::serializeMesh(const Mesh& mesh)
+{
+    auto align = [](uint64_t at) { return (at + PACK_ALIGNMENT - 1) & ~(PACK_ALIGNMENT - 1); };
+    bool shortIndices = mesh.indexType == GL_UNSIGNED_SHORT;
+    std::size_t indexCount = shortIndices ? mesh.shortIndices.size() : mesh.longIndices.size();
+    std::size_t indexBytes = indexCount * (shortIndices ? sizeof(unsigned short) : sizeof(unsigned int));
+
+    PackMeshHeader h;
+    std::memset(&h, 0, sizeof(h));
+    h.attributes = mesh.attributes;
+    h.indexType = mesh.indexType;
+    h.vertexCount = mesh.indexedVertices.size();
+    h.indexCount = indexCount;
+    h.submeshCount = mesh.submeshes.size();
+    h.largestVertex[0] = mesh.largestVertex.x;
+    h.largestVertex[1] = mesh.largestVertex.y;
+    h.largestVertex[2] = mesh.largestVertex.z;
+    h.submeshOffset = align(sizeof(PackMeshHeader));
+    h.vertexOffset = align(h.submeshOffset + sizeof(SubMesh) * h.submeshCount);
+    h.indexOffset = align(h.vertexOffset + sizeof(glm::vec3) * h.vertexCount);
+
+    std::vector<char> blob(h.indexOffset + indexBytes, 0);
+    std::memcpy(&blob[0], &h, sizeof(h));
+    if (h.submeshCount)
+        std::memcpy(&blob[h.submeshOffset], &mesh.submeshes[0], sizeof(SubMesh) * h.submeshCount);
+    if (h.vertexCount)
+        std::memcpy(&blob[h.vertexOffset], &mesh.indexedVertices[0].x, sizeof(glm::vec3) * h.vertexCount);
+    if (indexBytes)
+        std::memcpy(&blob[h.indexOffset], shortIndices ? (const void*)&mesh.shortIndices[0] : (const void*)&mesh.longIndices[0], indexBytes);
+    return blob;
+}
+
+bool PackBuilder::write(const char* packPath)
+{
+    auto align = [](uint64_t at) { return (at + PACK_ALIGNMENT - 1) & ~(PACK_ALIGNMENT - 1); };
+    std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) { return a.name < b.name; });
+
+    // 1. lay out the table of contents, names and blobs
+    PackHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "VTPK", 4);
+    header.version = PACK_VERSION;
+    header.entryCount = items.size();
+    header.entriesOffset = align(sizeof(PackHeader));
+    header.namesOffset = align(header.entriesOffset + sizeof(PackEntry) * items.size());
+
+    std::vector<PackEntry> entries(items.size());
+    std::string names;
+    for (std::size_t i = 0; i < items.size(); i++)
+    {
+        std::memset(&entries[i], 0, sizeof(PackEntry));
+        entries[i].nameOffset = names.size();
+        entries[i].nameLength = items[i].name.size();
+        names += items[i].name;
+    }
+    uint64_t at = align(header.namesOffset + names.size());
+    for (std::size_t i = 0; i < items.size(); i++)
+    {
+        entries[i].hash = items[i].hash;
+        entries[i].kind = items[i].kind;
+        entries[i].offset = at;
+        entries[i].size = items[i].blob.size();
+        at = align(at + items[i].blob.size());
+    }
+    header.fileSize = at;
+
+    // 2. write everything with zero padding between sections
+    std::ofstream out(packPath, std::ios::binary);
+    if (!out)
+    {
+        std::cout << "ERROR::PACK::FILE_NOT_SUCCESSFULLY_WRITTEN" << std::endl;
+        return false;
+    }
+    uint64_t written = 0;
+    auto put = [&](uint64_t offset, const void* data, std::size_t size)
+    {
+        static const char zeros[PACK_ALIGNMENT] = { 0 };
+        while (written < offset)
+        {
+            std::size_t pad = std::min<uint64_t>(offset - written, PACK_ALIGNMENT);
+            out.write(zeros, pad);
+            written += pad;
+        }
+        out.write((const char*)data, size);
+        written += size;
+    };
+    put(0, &header, sizeof(header));
+    put(header.entriesOffset, entries.data(), sizeof(PackEntry) * entries.size());
+    put(header.namesOffset, names.data(), names.size());
+    for (std::size_t i = 0; i < items.size(); i++)
+        put(entries[i].offset, items[i].blob.data(), items[i].blob.size());
+    put(header.fileSize, NULL, 0);
+    return (bool)out;
+}
+
+#endif
@@ -0,0 +1,722 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "mesh.hpp"
+#include "iosystem.hpp"
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <queue>
+#include <tuple>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+// .pm format version; streams of another version are not read
+const uint32_t PROGRESSIVE_VERSION = 2;
+
+// FNV-1a over the bytes of the source .obj (as stored, compressed or not), recorded in the
+// stream so an edited model is not shown from the stream of its old version; 0 when the
+// source cannot be read
+uint64_t progressiveKey(const char* objPath, IOSystem* io = NULL);
+
+// a single vertex split (the inverse of one half-edge collapse)
+struct VertexSplit
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    unsigned int parent;               // vertex the split vertex was collapsed into
+    std::vector<unsigned int> corners; // index buffer slots that switch from parent to the new vertex
+    std::vector<glm::uvec3> newFaces;  // faces restored by the split (appended to the index buffer)
+};
+
+// progressive mesh: a coarse base mesh plus an ordered stream of vertex splits that
+// refines it back to the original geometry. Vertex ids and face slots are assigned in
+// refinement order, so applying the first k splits only ever appends vertices/faces and
+// rewrites a few existing index slots.
+class ProgressiveMesh
+{
+public:
+    // the base mesh (interleaved position/normal pairs, like Mesh::triangles)
+    std::vector<glm::vec3> baseVertices;
+    std::vector<glm::uvec3> baseFaces;
+    // the refinement stream
+    std::vector<VertexSplit> splits;
+
+    // sizes of the fully refined mesh
+    unsigned int vertexCount;
+    unsigned int faceCount;
+    unsigned int splitCount; // number of splits in the full stream (may exceed splits.size() while streaming)
+    uint64_t sourceKey;      // progressiveKey of the .obj the stream was built from
+
+    // keep track of largest vertex for initial scaling on load-up
+    glm::vec3 largestVertex;
+
+    ProgressiveMesh();
+    // simplifies the mesh by quadric-error half-edge collapses until baseTriangles remain (0 picks ~2%)
+    void build(const Mesh& mesh, unsigned int baseTriangles = 0);
+    // writes the base mesh and split stream to disk
+    bool write(const char* pmPath) const;
+};
+
+// incremental decoder for .pm files; pump() consumes at most a given number of bytes per call
+// so the caller decides how fast data "arrives" and can render whatever prefix is decoded
+class ProgressiveStream
+{
+public:
+    ProgressiveMesh mesh;
+    bool headerReady;
+    bool baseReady;
+    bool complete;
+
+    ProgressiveStream();
+    ~ProgressiveStream();
+    // opens the stream through io (or the plain file system when that is NULL)
+    bool open(const char* pmPath, IOSystem* io = NULL);
+    // read up to maxBytes from the file and decode every complete record, returns bytes read
+    std::size_t pump(std::size_t maxBytes);
+private:
+    IOSystem* io;
+    IOStream* file;
+    std::vector<char> pending;
+    std::size_t cursor;
+
+    bool decode();
+    bool available(std::size_t bytes) const { return pending.size() - cursor >= bytes; }
+    template <typename T> T read() { T value; std::memcpy(&value, &pending[cursor], sizeof(T)); cursor += sizeof(T); return value; }
+};
+
+// GPU runtime for a progressive mesh: buffers are sized for the full mesh up front and
+// splits are applied (or undone) towards a target triangle count within a time budget
+class ProgressiveRenderer
+{
+public:
+    unsigned int VAO, VBO, EBO;
+    // number of splits currently applied and the resulting triangle count
+    unsigned int activeSplits;
+    unsigned int activeFaces;
+    // refinement stops at the largest prefix whose triangle count does not exceed this
+    unsigned int targetTriangles;
+
+    ProgressiveRenderer();
+    void load(const ProgressiveMesh& pm); // allocates full-size buffers and uploads the base mesh
+    unsigned int refine(const ProgressiveMesh& pm, double budgetMs); // returns number of splits applied/undone
+    void render();
+    void unload();
+private:
+    std::vector<unsigned int> indices; // CPU mirror of the element buffer
+    std::size_t dirtyBegin, dirtyEnd;  // dirty index range (in elements)
+    std::size_t vertexBegin, vertexEnd; // dirty vertex range (in vertices)
+};
+
+ProgressiveMesh::ProgressiveMesh()
+{
+    vertexCount = 0;
+    faceCount = 0;
+    splitCount = 0;
+    sourceKey = 0;
+    largestVertex = glm::vec3(0.0);
+}
+
+uint64_t progressiveKey(const char* objPath, IOSystem* io)
+{
+    if (io == NULL)
+        io = defaultIOSystem();
+    std::string source;
+    if (!io->readAll(objPath, source) || source.empty())
+        return 0;
+    uint64_t hash = 14695981039346656037ull ^ PROGRESSIVE_VERSION;
+    for (std::size_t i = 0; i < source.size(); i++)
+        hash = (hash ^ (unsigned char)source[i]) * 1099511628211ull;
+    return hash;
+}
+
+void ProgressiveMesh::build(const Mesh& mesh, unsigned int baseTriangles)
+{
+    baseVertices.clear();
+    baseFaces.clear();
+    splits.clear();
+    largestVertex = mesh.largestVertex;
+
+    // 1. weld the triangle soup by position (normals are averaged per position, or
+    // generated from the faces when the mesh was loaded without them)
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normalSums;
+    std::vector<glm::uvec3> faces;
+    std::map<std::tuple<float, float, float>, unsigned int> welded;
+    unsigned int step = mesh.stride();
+    for (std::size_t i = 0; i + 3 * step - 1 < mesh.triangles.size(); i += 3 * step)
+    {
+        unsigned int ids[3];
+        glm::vec3 faceNormal(0.0);
+        if (step == 1)
+            faceNormal = glm::cross(mesh.triangles[i + 1] - mesh.triangles[i], mesh.triangles[i + 2] - mesh.triangles[i]);
+        for (int k = 0; k < 3; k++)
+        {
+            glm::vec3 p = mesh.triangles[i + k * step];
+            auto key = std::make_tuple(p.x, p.y, p.z);
+            auto found = welded.find(key);
+            if (found == welded.end())
+            {
+                found = welded.emplace(key, (unsigned int)positions.size()).first;
+                positions.push_back(p);
+                normalSums.push_back(glm::vec3(0.0));
+            }
+            ids[k] = found->second;
+            normalSums[ids[k]] += step == 1 ? faceNormal : mesh.triangles[i + k * step + 1];
+        }
+        // drop faces that are degenerate after welding
+        if (ids[0] == ids[1] || ids[1] == ids[2] || ids[0] == ids[2])
+            continue;
+        faces.push_back(glm::uvec3(ids[0], ids[1], ids[2]));
+    }
+
+    unsigned int numVerts = positions.size();
+    unsigned int numFaces = faces.size();
+    vertexCount = numVerts;
+    faceCount = numFaces;
+    splitCount = 0;
+    if (numFaces == 0)
+        return;
+    if (baseTriangles == 0)
+        baseTriangles = std::max(32u, numFaces / 50);
+
+    // 2. adjacency and per-vertex error quadrics
+    std::vector<std::vector<unsigned int>> vertFaces(numVerts);
+    std::vector<glm::dmat4> quadrics(numVerts, glm::dmat4(0.0));
+    for (unsigned int f = 0; f < numFaces; f++)
+    {
+        glm::dvec3 a = positions[faces[f].x], b = positions[faces[f].y], c = positions[faces[f].z];
+        glm::dvec3 n = glm::cross(b - a, c - a);
+        double len = glm::length(n);
+        if (len > 0.0)
+            n /= len;
+        glm::dvec4 plane(n, -glm::dot(n, a));
+        glm::dmat4 q = glm::outerProduct(plane, plane);
+        for (int k = 0; k < 3; k++)
+        {
+            vertFaces[faces[f][k]].push_back(f);
+            quadrics[faces[f][k]] += q;
+        }
+    }
+
+    std::vector<bool> vertAlive(numVerts, true);
+    std::vector<bool> faceAlive(numFaces, true);
+    std::vector<unsigned int> stamp(numVerts, 0);
+
+    // half-edge collapse candidate u -> v, ordered by quadric error at v
+    struct Candidate
+    {
+        double cost;
+        unsigned int u, v;
+        unsigned int stampU, stampV;
+        bool operator>(const Candidate& other) const { return cost > other.cost; }
+    };
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> queue;
+
+    auto pushCandidate = [&](unsigned int u, unsigned int v)
+    {
+        glm::dvec4 p(glm::dvec3(positions[v]), 1.0);
+        double cost = glm::dot(p, (quadrics[u] + quadrics[v]) * p);
+        queue.push({ cost, u, v, stamp[u], stamp[v] });
+    };
+    auto neighbours = [&](unsigned int v, std::vector<unsigned int>& out)
+    {
+        out.clear();
+        for (unsigned int f : vertFaces[v])
+            for (int k = 0; k < 3; k++)
+                if (faces[f][k] != v)
+                    out.push_back(faces[f][k]);
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    };
+
+    std::vector<unsigned int> ring, ringV;
+    for (unsigned int v = 0; v < numVerts; v++)
+    {
+        neighbours(v, ring);
+        for (unsigned int w : ring)
+            pushCandidate(v, w);
+    }
+
+    // a collapse as recorded while simplifying (original vertex/face ids)
+    struct Collapse
+    {
+        unsigned int u, v;
+        std::vector<unsigned int> corners; // face * 3 + k slots that held u
+        std::vector<unsigned int> removed; // faces containing both u and v
+        std::vector<glm::uvec3> removedFaces;
+    };
+    std::vector<Collapse> collapses;
+    unsigned int aliveFaces = numFaces;
+
+    // 3. greedily collapse the cheapest valid edges
+    while (!queue.empty() && aliveFaces > baseTriangles)
+    {
+        Candidate c = queue.top();
+        queue.pop();
+        unsigned int u = c.u, v = c.v;
+        if (!vertAlive[u] || !vertAlive[v] || c.stampU != stamp[u] || c.stampV != stamp[v])
+            continue;
+
+        // split u's faces into those shared with v (removed) and the rest (modified)
+        std::vector<unsigned int> shared, moved;
+        for (unsigned int f : vertFaces[u])
+        {
+            const glm::uvec3& face = faces[f];
+            if (face.x == v || face.y == v || face.z == v)
+                shared.push_back(f);
+            else
+                moved.push_back(f);
+        }
+        if (shared.empty())
+            continue;
+
+        // link condition: the common neighbours must be exactly the apexes of the shared faces
+        neighbours(u, ring);
+        neighbours(v, ringV);
+        std::vector<unsigned int> common;
+        std::set_intersection(ring.begin(), ring.end(), ringV.begin(), ringV.end(), std::back_inserter(common));
+        if (common.size() != shared.size())
+            continue;
+
+        // reject collapses that flip or crush a face
+        bool valid = true;
+        for (unsigned int f : moved)
+        {
+            glm::vec3 p[3], q[3];
+            for (int k = 0; k < 3; k++)
+            {
+                p[k] = positions[faces[f][k]];
+                q[k] = faces[f][k] == u ? positions[v] : p[k];
+            }
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+            if (glm::dot(before, after) <= 0.0f)
+            {
+                valid = false;
+                break;
+            }
+        }
+        if (!valid)
+            continue;
+
+        // perform the collapse
+        Collapse record;
+        record.u = u;
+        record.v = v;
+        for (unsigned int f : shared)
+        {
+            record.removed.push_back(f);
+            record.removedFaces.push_back(faces[f]);
+            faceAlive[f] = false;
+            aliveFaces--;
+            for (int k = 0; k < 3; k++)
+            {
+                std::vector<unsigned int>& adj = vertFaces[faces[f][k]];
+                adj.erase(std::remove(adj.begin(), adj.end(), f), adj.end());
+            }
+        }
+        for (unsigned int f : moved)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                if (faces[f][k] == u)
+                {
+                    faces[f][k] = v;
+                    record.corners.push_back(f * 3 + k);
+                }
+            }
+            vertFaces[v].push_back(f);
+        }
+        vertFaces[u].clear();
+        vertAlive[u] = false;
+        quadrics[v] += quadrics[u];
+        collapses.push_back(record);
+
+        // refresh the candidates around v
+        stamp[v]++;
+        neighbours(v, ring);
+        for (unsigned int w : ring)
+        {
+            stamp[w]++;
+        }
+        for (unsigned int w : ring)
+        {
+            pushCandidate(v, w);
+            pushCandidate(w, v);
+            neighbours(w, ringV);
+            for (unsigned int x : ringV)
+                if (x != v)
+                {
+                    pushCandidate(w, x);
+                    pushCandidate(x, w);
+                }
+        }
+    }
+
+    // 4. assign final ids in refinement order
+    std::vector<unsigned int> vertId(numVerts, 0), faceId(numFaces, 0);
+    unsigned int nextVert = 0, nextFace = 0;
+    for (unsigned int v = 0; v < numVerts; v++)
+        if (vertAlive[v])
+            vertId[v] = nextVert++;
+    for (unsigned int f = 0; f < numFaces; f++)
+        if (faceAlive[f])
+            faceId[f] = nextFace++;
+    for (auto it = collapses.rbegin(); it != collapses.rend(); ++it)
+    {
+        vertId[it->u] = nextVert++;
+        for (unsigned int f : it->removed)
+            faceId[f] = nextFace++;
+    }
+
+    auto vertexNormal = [&](unsigned int v)
+    {
+        float len = glm::length(normalSums[v]);
+        return len > 0.0f ? normalSums[v] / len : glm::vec3(0.0, 0.0, 1.0);
+    };
+
+    // 5. emit the base mesh and the split stream
+    for (unsigned int v = 0; v < numVerts; v++)
+    {
+        if (!vertAlive[v])
+            continue;
+        baseVertices.push_back(positions[v]);
+        baseVertices.push_back(vertexNormal(v));
+    }
+    for (unsigned int f = 0; f < numFaces; f++)
+        if (faceAlive[f])
+            baseFaces.push_back(glm::uvec3(vertId[faces[f].x], vertId[faces[f].y], vertId[faces[f].z]));
+
+    for (auto it = collapses.rbegin(); it != collapses.rend(); ++it)
+    {
+        VertexSplit split;
+        split.position = positions[it->u];
+        split.normal = vertexNormal(it->u);
+        split.parent = vertId[it->v];
+        for (unsigned int corner : it->corners)
+            split.corners.push_back(faceId[corner / 3] * 3 + corner % 3);
+        for (const glm::uvec3& face : it->removedFaces)
+            split.newFaces.push_back(glm::uvec3(vertId[face.x], vertId[face.y], vertId[face.z]));
+        splits.push_back(split);
+    }
+    splitCount = splits.size();
+}
+
+bool ProgressiveMesh::write(const char* pmPath) const
+{
+    std::ofstream out(pmPath, std::ios::binary);
+    if (!out || baseFaces.empty())
+    {
+        std::cout << "ERROR::PROGRESSIVE::FILE_NOT_SUCCESSFULLY_WRITTEN" << std::endl;
+        return false;
+    }
+    auto put = [&out](const void* data, std::size_t size) { out.write((const char*)data, size); };
+
+    // header
+    const char magic[4] = { 'P', 'M', 'S', 'H' };
+    uint32_t header[6] = { PROGRESSIVE_VERSION, vertexCount, faceCount, (uint32_t)(baseVertices.size() / 2), (uint32_t)baseFaces.size(), (uint32_t)splits.size() };
+    put(magic, sizeof(magic));
+    put(header, sizeof(header));
+    put(&sourceKey, sizeof(sourceKey));
+    put(&largestVertex.x, sizeof(glm::vec3));
+
+    // base mesh
+    put(&baseVertices[0].x, sizeof(glm::vec3) * baseVertices.size());
+    put(&baseFaces[0].x, sizeof(glm::uvec3) * baseFaces.size());
+
+    // vertex splits
+    for (const VertexSplit& split : splits)
+    {
+        uint32_t counts[3] = { split.parent, (uint32_t)split.corners.size(), (uint32_t)split.newFaces.size() };
+        put(counts, sizeof(counts));
+        put(&split.position.x, sizeof(glm::vec3));
+        put(&split.normal.x, sizeof(glm::vec3));
+        if (!split.corners.empty())
+            put(&split.corners[0], sizeof(unsigned int) * split.corners.size());
+        if (!split.newFaces.empty())
+            put(&split.newFaces[0].x, sizeof(glm::uvec3) * split.newFaces.size());
+    }
+    return (bool)out;
+}
+
+ProgressiveStream::ProgressiveStream()
+{
+    io = NULL;
+    file = NULL;
+    headerReady = false;
+    baseReady = false;
+    complete = false;
+    cursor = 0;
+}
+
+ProgressiveStream::~ProgressiveStream()
+{
+    if (file)
+        io->close(file);
+}
+
+bool ProgressiveStream::open(const char* pmPath, IOSystem* io)
+{
+    this->io = io ? io : defaultIOSystem();
+    file = this->io->open(pmPath);
+    return file != NULL;
+}
+
+std::size_t ProgressiveStream::pump(std::size_t maxBytes)
+{
+    if (complete || file == NULL)
+        return 0;
+
+    // drop consumed bytes before appending new ones
+    if (cursor > 0)
+    {
+        pending.erase(pending.begin(), pending.begin() + cursor);
+        cursor = 0;
+    }
+    std::size_t oldSize = pending.size();
+    pending.resize(oldSize + maxBytes);
+    std::size_t got = file->read(&pending[oldSize], 1, maxBytes);
+    pending.resize(oldSize + got);
+
+    while (decode())
+        ;
+    if (got == 0 && !complete)
+    {
+        std::cout << "ERROR::PROGRESSIVE::STREAM_TRUNCATED" << std::endl;
+        complete = true;
+    }
+    return got;
+}
+
+bool ProgressiveStream::decode()
+{
+    if (!headerReady)
+    {
+        const std::size_t headerSize = 4 + sizeof(uint32_t) * 6 + sizeof(uint64_t) + sizeof(glm::vec3);
+        if (!available(headerSize))
+            return false;
+        if (std::memcmp(&pending[cursor], "PMSH", 4) != 0)
+        {
+            std::cout << "ERROR::PROGRESSIVE::INVALID_STREAM" << std::endl;
+            complete = true;
+            return false;
+        }
+        cursor += 4;
+        if (read<uint32_t>() != PROGRESSIVE_VERSION)
+        {
+            // an older stream: the caller sees no header and builds a new one
+            complete = true;
+            return false;
+        }
+        mesh.vertexCount = read<uint32_t>();
+        mesh.faceCount = read<uint32_t>();
+        mesh.baseVertices.resize(read<uint32_t>() * 2);
+        mesh.baseFaces.resize(read<uint32_t>());
+        mesh.splitCount = read<uint32_t>();
+        mesh.sourceKey = read<uint64_t>();
+        mesh.largestVertex = read<glm::vec3>();
+        headerReady = true;
+        return true;
+    }
+
+    if (!baseReady)
+    {
+        std::size_t vertBytes = sizeof(glm::vec3) * mesh.baseVertices.size();
+        std::size_t faceBytes = sizeof(glm::uvec3) * mesh.baseFaces.size();
+        if (!available(vertBytes + faceBytes))
+            return false;
+        std::memcpy(&mesh.baseVertices[0].x, &pending[cursor], vertBytes);
+        std::memcpy(&mesh.baseFaces[0].x, &pending[cursor + vertBytes], faceBytes);
+        cursor += vertBytes + faceBytes;
+        baseReady = true;
+        complete = mesh.splitCount == 0;
+        return true;
+    }
+
+    if (mesh.splits.size() >= mesh.splitCount)
+    {
+        complete = true;
+        return false;
+    }
+
+    // one vertex split record
+    const std::size_t fixedSize = sizeof(uint32_t) * 3 + sizeof(glm::vec3) * 2;
+    if (!available(fixedSize))
+        return false;
+    uint32_t counts[3];
+    std::memcpy(counts, &pending[cursor], sizeof(counts));
+    std::size_t recordSize = fixedSize + sizeof(uint32_t) * counts[1] + sizeof(glm::uvec3) * counts[2];
+    if (!available(recordSize))
+        return false;
+
+    VertexSplit split;
+    cursor += sizeof(counts);
+    split.parent = counts[0];
+    split.position = read<glm::vec3>();
+    split.normal = read<glm::vec3>();
+    split.corners.resize(counts[1]);
+    split.newFaces.resize(counts[2]);
+    for (unsigned int& corner : split.corners)
+        corner = read<uint32_t>();
+    for (glm::uvec3& face : split.newFaces)
+        face = read<glm::uvec3>();
+    mesh.splits.push_back(split);
+    complete = mesh.splits.size() >= mesh.splitCount;
+    return true;
+}
+
+ProgressiveRenderer::ProgressiveRenderer()
+{
+    VAO = VBO = EBO = 0;
+    activeSplits = 0;
+    activeFaces = 0;
+    targetTriangles = 0xFFFFFFFFu;
+    dirtyBegin = dirtyEnd = 0;
+    vertexBegin = vertexEnd = 0;
+}
+
+void ProgressiveRenderer::load(const ProgressiveMesh& pm)
+{
+    activeSplits = 0;
+    activeFaces = pm.baseFaces.size();
+    indices.assign(pm.faceCount * 3, 0);
+    std::memcpy(&indices[0], &pm.baseFaces[0].x, sizeof(glm::uvec3) * pm.baseFaces.size());
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    glBindVertexArray(VAO);
+
+    // allocate storage for the fully refined mesh, then upload only the base
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * 2 * pm.vertexCount, NULL, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * pm.baseVertices.size(), &pm.baseVertices[0].x);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(), &indices[0], GL_DYNAMIC_DRAW);
+
+    // position attribute
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    // normal attribute
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+
+    glBindVertexArray(0);
+}
+
+unsigned int ProgressiveRenderer::refine(const ProgressiveMesh& pm, double budgetMs)
+{
+    auto start = std::chrono::steady_clock::now();
+    unsigned int baseVerts = pm.baseVertices.size() / 2;
+    unsigned int steps = 0;
+    dirtyBegin = vertexBegin = SIZE_MAX;
+    dirtyEnd = vertexEnd = 0;
+
+    auto markIndex = [this](std::size_t begin, std::size_t end)
+    {
+        dirtyBegin = std::min(dirtyBegin, begin);
+        dirtyEnd = std::max(dirtyEnd, end);
+    };
+
+    std::vector<glm::vec3> newVertices;
+    while (true)
+    {
+        // refine while the next split stays within the target, coarsen while above it
+        if (activeSplits < pm.splits.size() && activeFaces + pm.splits[activeSplits].newFaces.size() <= targetTriangles)
+        {
+            const VertexSplit& split = pm.splits[activeSplits];
+            unsigned int vertex = baseVerts + activeSplits;
+            for (unsigned int corner : split.corners)
+            {
+                indices[corner] = vertex;
+                markIndex(corner, corner + 1);
+            }
+            if (!split.newFaces.empty())
+                std::memcpy(&indices[activeFaces * 3], &split.newFaces[0].x, sizeof(glm::uvec3) * split.newFaces.size());
+            markIndex(activeFaces * 3, (activeFaces + split.newFaces.size()) * 3);
+
+            // vertices are appended in split order so new ones are always contiguous
+            if (vertexBegin == SIZE_MAX)
+                vertexBegin = vertex;
+            vertexEnd = vertex + 1;
+            newVertices.push_back(split.position);
+            newVertices.push_back(split.normal);
+
+            activeFaces += split.newFaces.size();
+            activeSplits++;
+        }
+        else if (activeSplits > 0 && activeFaces > targetTriangles)
+        {
+            const VertexSplit& split = pm.splits[activeSplits - 1];
+            for (unsigned int corner : split.corners)
+            {
+                indices[corner] = split.parent;
+                markIndex(corner, corner + 1);
+            }
+            activeFaces -= split.newFaces.size();
+            activeSplits--;
+            // the vertex data stays in the buffer, it is simply no longer referenced
+            if (vertexEnd > baseVerts + activeSplits)
+            {
+                vertexEnd = std::max(vertexBegin, (std::size_t)(baseVerts + activeSplits));
+                newVertices.resize((vertexEnd - vertexBegin) * 2);
+            }
+        }
+        else
+            break;
+
+        steps++;
+        // check the clock every few splits to keep the overhead low
+        if (steps % 64 == 0)
+        {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() >= budgetMs)
+                break;
+        }
+    }
+
+    // upload the touched ranges once (through the VAO so its element binding is left intact)
+    glBindVertexArray(VAO);
+    if (vertexBegin != SIZE_MAX && vertexEnd > vertexBegin)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * 2 * vertexBegin, sizeof(glm::vec3) * 2 * (vertexEnd - vertexBegin), &newVertices[0].x);
+    }
+    if (dirtyEnd > dirtyBegin)
+    {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * dirtyBegin, sizeof(unsigned int) * (dirtyEnd - dirtyBegin), &indices[dirtyBegin]);
+    }
+    glBindVertexArray(0);
+    return steps;
+}
+
+void ProgressiveRenderer::render()
+{
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, activeFaces * 3, GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+}
+
+void ProgressiveRenderer::unload()
+{
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+}
+
+#endif
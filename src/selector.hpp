@@ -0,0 +1,209 @@
+#ifndef SELECTOR_H
+#define SELECTOR_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <string>
+#include <iostream>
+
+enum TransformPath
+{
+    TRANSFORM_GPU = 0, // model matrix applied in the vertex shader
+    TRANSFORM_CPU = 1  // vertices transformed on the CPU and streamed (Mesh::applyTransform)
+};
+
+// picks the cheaper transform path from live measurements: after load, and whenever the cost of
+// the chosen path drifts far from what was measured, each path is rendered for a few frames and
+// timed (GL timer queries around the draw, CPU timestamps around the transform); the other path
+// only takes over when it is clearly cheaper, and every decision is logged
+class TransformSelector
+{
+public:
+    TransformSelector(unsigned int sampleFrames = 16, double hysteresis = 0.15);
+    void init();    // creates the timer queries (needs a current context)
+    void release();
+    // starts a new measurement round, reason goes to the log
+    void remeasure(const std::string& reason);
+    // the path to render with this frame (now in seconds)
+    TransformPath beginFrame(double now);
+    // timer query around the measured draw
+    void beginDraw();
+    void endDraw();
+    // CPU milliseconds this frame spent transforming (call every frame the CPU path is used)
+    void addCpuTime(double ms);
+    // hands out one finished GPU timing, false when none is ready
+    bool collect(TransformPath& path, double& gpuMs);
+    bool measuring() const { return phase != PHASE_DECIDED; }
+private:
+    enum Phase { PHASE_MEASURE_FIRST, PHASE_MEASURE_SECOND, PHASE_DECIDED };
+    struct Samples
+    {
+        double gpuMs, cpuMs;
+        unsigned int gpuCount, cpuCount;
+        double cost() const { return (gpuCount ? gpuMs / gpuCount : 0.0) + (cpuCount ? cpuMs / cpuCount : 0.0); }
+    };
+    struct Query
+    {
+        unsigned int id;
+        TransformPath path;
+        bool pending;
+    };
+    void decide();
+
+    unsigned int sampleFrames;
+    double hysteresis;
+    Phase phase;
+    TransformPath current;  // the path of this frame
+    TransformPath decided;  // the last decision
+    Samples samples[2];
+    Query queries[4];
+    int activeQuery;
+    std::string reason;
+    double measuredCost;    // cost of the decided path when it was chosen
+    double gpuAverage, cpuAverage; // running averages of the decided path
+    double decidedAt;
+    double now;
+};
+
+TransformSelector::TransformSelector(unsigned int sampleFrames, double hysteresis)
+{
+    this->sampleFrames = sampleFrames;
+    this->hysteresis = hysteresis;
+    current = decided = TRANSFORM_GPU;
+    activeQuery = -1;
+    measuredCost = gpuAverage = cpuAverage = 0.0;
+    decidedAt = now = 0.0;
+    for (Query& query : queries)
+        query = Query{ 0, TRANSFORM_GPU, false };
+    remeasure("after load");
+}
+
+void TransformSelector::init()
+{
+    for (Query& query : queries)
+        glGenQueries(1, &query.id);
+}
+
+void TransformSelector::release()
+{
+    for (Query& query : queries)
+    {
+        if (query.id)
+            glDeleteQueries(1, &query.id);
+        query = Query{ 0, TRANSFORM_GPU, false };
+    }
+}
+
+void TransformSelector::remeasure(const std::string& reason)
+{
+    this->reason = reason;
+    phase = PHASE_MEASURE_FIRST;
+    samples[0] = samples[1] = Samples{ 0.0, 0.0, 0, 0 };
+}
+
+TransformPath TransformSelector::beginFrame(double now)
+{
+    this->now = now;
+    // measure the decided path first, then the other one
+    if (phase == PHASE_MEASURE_FIRST && samples[decided].gpuCount >= sampleFrames)
+        phase = PHASE_MEASURE_SECOND;
+    if (phase == PHASE_MEASURE_SECOND && samples[1 - decided].gpuCount >= sampleFrames)
+        decide();
+
+    if (phase == PHASE_MEASURE_FIRST)
+        current = decided;
+    else if (phase == PHASE_MEASURE_SECOND)
+        current = (TransformPath)(1 - decided);
+    else
+    {
+        current = decided;
+        // the workload changed (model started or stopped moving, window resized, ...)
+        double cost = gpuAverage + cpuAverage;
+        if (now - decidedAt > 3.0 && (cost > measuredCost * 1.5 + 0.05 || cost < measuredCost * 0.5 - 0.05))
+            remeasure("cost drifted from " + std::to_string(measuredCost) + " to " + std::to_string(cost) + " ms");
+    }
+    return current;
+}
+
+void TransformSelector::beginDraw()
+{
+    activeQuery = -1;
+    for (int i = 0; i < 4; i++)
+    {
+        if (queries[i].id && !queries[i].pending)
+        {
+            activeQuery = i;
+            break;
+        }
+    }
+    // every query still in flight: this frame goes untimed
+    if (activeQuery < 0)
+        return;
+    queries[activeQuery].path = current;
+    glBeginQuery(GL_TIME_ELAPSED, queries[activeQuery].id);
+}
+
+void TransformSelector::endDraw()
+{
+    if (activeQuery < 0)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    queries[activeQuery].pending = true;
+    activeQuery = -1;
+}
+
+void TransformSelector::addCpuTime(double ms)
+{
+    Samples& s = samples[current];
+    s.cpuMs += ms;
+    s.cpuCount++;
+    if (phase == PHASE_DECIDED)
+        cpuAverage = cpuAverage * 0.9 + ms * 0.1;
+}
+
+bool TransformSelector::collect(TransformPath& path, double& gpuMs)
+{
+    for (Query& query : queries)
+    {
+        if (!query.pending)
+            continue;
+        int available = 0;
+        glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &elapsed);
+        query.pending = false;
+        path = query.path;
+        gpuMs = elapsed * 1e-6;
+
+        samples[path].gpuMs += gpuMs;
+        samples[path].gpuCount++;
+        if (phase == PHASE_DECIDED && path == decided)
+            gpuAverage = gpuAverage * 0.9 + gpuMs * 0.1;
+        return true;
+    }
+    return false;
+}
+
+void TransformSelector::decide()
+{
+    double gpu = samples[TRANSFORM_GPU].cost();
+    double cpu = samples[TRANSFORM_CPU].cost();
+    TransformPath previous = decided;
+    TransformPath other = (TransformPath)(1 - decided);
+    // hysteresis: the other path has to beat the current one by a margin
+    if (samples[other].cost() < samples[decided].cost() * (1.0 - hysteresis))
+        decided = other;
+
+    std::cout << "Transform path: " << (decided == TRANSFORM_GPU ? "GPU" : "CPU") << " (GPU " << gpu << " ms, CPU "
+              << cpu << " ms per frame, " << reason << (decided != previous ? ", switched" : ", kept") << ")" << std::endl;
+    phase = PHASE_DECIDED;
+    measuredCost = samples[decided].cost();
+    gpuAverage = samples[decided].gpuCount ? samples[decided].gpuMs / samples[decided].gpuCount : 0.0;
+    cpuAverage = samples[decided].cpuCount ? samples[decided].cpuMs / samples[decided].cpuCount : 0.0;
+    decidedAt = now;
+}
+
+#endif
@@ -5,97 +5,242 @@
 #include <GL/glew.h>
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "iosystem.hpp"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// bytes of the shadow copy kept per uniform (a mat4)
+const unsigned int SHADER_SHADOW_SIZE = 64;
+
+// a uniform of the default block resolved once at link time; sets through an invalid handle
+// (a uniform the compiler removed, or one of another type) do nothing
+template <typename T>
+struct Uniform
+{
+    int location = -1;
+    unsigned int slot = 0;   // the uniform's shadow copy
+    bool valid() const { return location >= 0; }
+};
+
+// what reflection found about an active uniform
+struct UniformInfo
+{
+    int location;
+    unsigned int type;  // GL_FLOAT_VEC3, ...
+    unsigned int slot;
+};
 
 class Shader
 {
 public:
     // the program ID
     unsigned int ID;
+    // the program's active interface, enumerated at link time: uniforms outside blocks,
+    // vertex inputs (name -> location), and uniform blocks (name -> size in bytes)
+    std::unordered_map<std::string, UniformInfo> uniforms;
+    std::unordered_map<std::string, int> attributes;
+    std::unordered_map<std::string, int> blocks;
+    // whether the program came out of the binary cache instead of being compiled
+    bool cached = false;
+    // whether the program linked; only known once finished
+    bool linked = false;
 
-    // constructor reads and builds the shader
-    Shader(const char* vertexPath, const char* fragmentPath);
+    // constructor reads (through io, or the plain file system when that is NULL) and builds the
+    // shader; with a binaryPath the linked program is cached there and restored next time.
+    // deferred only issues the compile and link, so the driver can work on them while the
+    // caller does something else, and leaves the rest to finish
+    Shader(const char* vertexPath, const char* fragmentPath, IOSystem* io = NULL, const char* binaryPath = NULL, bool deferred = false);
+    // whether finish would return without waiting for the driver; always true without
+    // KHR_parallel_shader_compile, which is the only way to ask
+    bool ready() const;
+    // waits for the compile and link, reports their errors and reflects the program
+    bool finish();
     // use/activate the shader
     void use();
-    // utility uniform functions
-    void setBool(const std::string &name, bool value) const;
-    void setInt(const std::string &name, int value) const;
-    void setFloat(const std::string &name, float value) const;
-    void setVec3(const std::string &name, float x, float y, float z) const;
-    void setVec3(const std::string &name, glm::vec3 pos) const;
+    // whether the vertex shader actually consumes the named input
+    bool hasAttribute(const char* name) const;
+    // size of the named uniform block, -1 when the program has none by that name
+    int blockSize(const char* name) const;
+
+    // typed handle of a uniform, resolved once (look it up outside the render loop)
+    template <typename T>
+    Uniform<T> uniform(const std::string& name);
+    // uploads to this program with glProgramUniform, whether or not it is the one in use,
+    // unless the value equals what the program already holds
+    template <typename T>
+    void set(const Uniform<T>& handle, const T& value);
+
+    // utility uniform functions, the slow path: every call hashes the name to find the uniform
+    // before doing the same as set; anything set per frame should keep a handle from uniform
+    void setBool(const std::string &name, bool value);
+    void setInt(const std::string &name, int value);
+    void setFloat(const std::string &name, float value);
+    void setVec3(const std::string &name, float x, float y, float z);
+    void setVec3(const std::string &name, glm::vec3 pos);
+private:
+    // a deferred build not finished yet, and what finishing it needs
+    bool pending = false;
+    unsigned int vertexShader = 0, fragmentShader = 0;
+    std::string binaryPath;
+    uint64_t key = 0;
+    // last value uploaded per uniform, SHADER_SHADOW_SIZE bytes each, and whether there is one
+    std::vector<unsigned char> shadow;
+    std::vector<char> shadowValid;
+    // fills the interface tables after linking
+    void reflect();
 };
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath)
+// lets the driver compile and link on threads of its own (KHR or ARB_parallel_shader_compile),
+// so deferred shaders build in the background; false when it cannot
+bool enableParallelShaderCompile();
+
+// linked programs cached with glGetProgramBinary, keyed by the sources and by the driver that
+// built them; a binary the driver no longer accepts (an updated driver, another GPU) is
+// silently replaced by compiling again
+bool programBinarySupported();
+uint64_t programKey(const std::string& vertexCode, const std::string& fragmentCode);
+bool readProgramBinary(unsigned int program, const char* path, uint64_t key);
+bool writeProgramBinary(unsigned int program, const char* path, uint64_t key);
+
+// the GL type a uniform must have to be set as T, and the upload for it; glProgramUniform is
+// GL 4.1, which the #version 450 shaders need anyway
+template <typename T> struct UniformTraits;
+template <> struct UniformTraits<float>
+{
+    static bool accepts(unsigned int type) { return type == GL_FLOAT; }
+    static void upload(unsigned int program, int location, const float& v) { glProgramUniform1f(program, location, v); }
+};
+template <> struct UniformTraits<int>
+{
+    // samplers are set as ints
+    static bool accepts(unsigned int type) { return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_CUBE || type == GL_SAMPLER_2D_SHADOW; }
+    static void upload(unsigned int program, int location, const int& v) { glProgramUniform1i(program, location, v); }
+};
+template <> struct UniformTraits<bool>
+{
+    static bool accepts(unsigned int type) { return type == GL_BOOL || type == GL_INT; }
+    static void upload(unsigned int program, int location, const bool& v) { glProgramUniform1i(program, location, (int)v); }
+};
+template <> struct UniformTraits<glm::vec2>
+{
+    static bool accepts(unsigned int type) { return type == GL_FLOAT_VEC2; }
+    static void upload(unsigned int program, int location, const glm::vec2& v) { glProgramUniform2fv(program, location, 1, glm::value_ptr(v)); }
+};
+template <> struct UniformTraits<glm::vec3>
+{
+    static bool accepts(unsigned int type) { return type == GL_FLOAT_VEC3; }
+    static void upload(unsigned int program, int location, const glm::vec3& v) { glProgramUniform3fv(program, location, 1, glm::value_ptr(v)); }
+};
+template <> struct UniformTraits<glm::vec4>
+{
+    static bool accepts(unsigned int type) { return type == GL_FLOAT_VEC4; }
+    static void upload(unsigned int program, int location, const glm::vec4& v) { glProgramUniform4fv(program, location, 1, glm::value_ptr(v)); }
+};
+template <> struct UniformTraits<glm::mat3>
+{
+    static bool accepts(unsigned int type) { return type == GL_FLOAT_MAT3; }
+    static void upload(unsigned int program, int location, const glm::mat3& v) { glProgramUniformMatrix3fv(program, location, 1, GL_FALSE, glm::value_ptr(v)); }
+};
+template <> struct UniformTraits<glm::mat4>
+{
+    static bool accepts(unsigned int type) { return type == GL_FLOAT_MAT4; }
+    static void upload(unsigned int program, int location, const glm::mat4& v) { glProgramUniformMatrix4fv(program, location, 1, GL_FALSE, glm::value_ptr(v)); }
+};
+
+Shader::Shader(const char* vertexPath, const char* fragmentPath, IOSystem* io, const char* binaryPath, bool deferred)
 {
     // 1. retrieve the vertex/fragment source code from filePath
     std::string vertexCode;
     std::string fragmentCode;
-    std::ifstream vShaderFile;
-    std::ifstream fShaderFile;
-    // ensure ifstream objects can throw exceptions
-    vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-    fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-    try
-    {
-        // open files
-        vShaderFile.open(vertexPath);
-        fShaderFile.open(fragmentPath);
-        std::stringstream vShaderStream, fShaderStream;
-        // read file's buffer contents into streams
-        vShaderStream << vShaderFile.rdbuf();
-        fShaderStream << fShaderFile.rdbuf();
-        // close file handlers
-        vShaderFile.close();
-        fShaderFile.close();
-        // convert stream into string
-        vertexCode   = vShaderStream.str();
-        fragmentCode = fShaderStream.str();
-    }
-    catch (std::ifstream::failure e)
+    if (io == NULL)
+        io = defaultIOSystem();
+    if (!io->readAll(vertexPath, vertexCode) || !io->readAll(fragmentPath, fragmentCode))
     {
         std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
     }
     const char* vShaderCode = vertexCode.c_str();
     const char* fShaderCode = fragmentCode.c_str();
 
-    // 2. compile shaders
-    unsigned int vertex, fragment;
+    // a program linked from these sources on this driver before needs no compiling
+    bool useBinary = binaryPath != NULL && programBinarySupported();
+    key = useBinary ? programKey(vertexCode, fragmentCode) : 0;
+    if (useBinary)
+    {
+        ID = glCreateProgram();
+        if (readProgramBinary(ID, binaryPath, key))
+        {
+            cached = true;
+            linked = true;
+            reflect();
+            return;
+        }
+        glDeleteProgram(ID);
+        this->binaryPath = binaryPath;
+    }
+
+    // 2. compile shaders and link them; the statuses are only asked for in finish, as asking
+    // waits for the driver
+    vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexShader, 1, &vShaderCode, NULL);
+    glCompileShader(vertexShader);
+    fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 1, &fShaderCode, NULL);
+    glCompileShader(fragmentShader);
+
+    // shader program
+    ID = glCreateProgram();
+    glAttachShader(ID, vertexShader);
+    glAttachShader(ID, fragmentShader);
+    if (useBinary)
+        glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(ID);
+    pending = true;
+    if (!deferred)
+        finish();
+}
+
+bool Shader::ready() const
+{
+    if (!pending || !(GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile))
+        return true;
+    GLint done = 0;
+    glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+    return done != 0;
+}
+
+bool Shader::finish()
+{
+    if (!pending)
+        return linked;
+    pending = false;
     int success;
     char infoLog[512];
 
-    // vertex Shader
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
     // print compile errors if any
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
     if (!success)
     {
-        glGetShaderInfoLog(vertex, 512, NULL, infoLog);
+        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
         std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
     }
-
-    // fragment Shader
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
-    // print compile errors if any
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
     if (!success)
     {
-        glGetShaderInfoLog(fragment, 512, NULL, infoLog);
+        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
         std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
     }
 
-    // shader program
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
-    glLinkProgram(ID);
     // print linking errors if any
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
     if (!success)
@@ -103,40 +248,273 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
         glGetProgramInfoLog(ID, 512, NULL, infoLog);
         std::cout << "ERROR:SHADER:PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
     }
+    else
+    {
+        linked = true;
+        reflect();
+        if (!binaryPath.empty())
+            writeProgramBinary(ID, binaryPath.c_str(), key);
+    }
 
     // delete the shaders as they're linked into our program now and no longer necessary
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    vertexShader = fragmentShader = 0;
+    return linked;
 }
 
 void Shader::use()
 {
+    finish();
     glUseProgram(ID);
 }
 
-void Shader::setBool(const std::string &name, bool value) const
+void Shader::reflect()
+{
+    uniforms.clear();
+    attributes.clear();
+    blocks.clear();
+    std::vector<char> name(256);
+    auto addUniform = [&](std::string uniformName, int location, unsigned int type)
+    {
+        // block members have no location; arrays are listed by their first element
+        if (location < 0)
+            return;
+        if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+            uniformName.resize(uniformName.size() - 3);
+        // the slot is taken before inserting, so the slots run 0..N-1 like the shadow copies
+        unsigned int slot = uniforms.size();
+        uniforms.emplace(uniformName, UniformInfo{ location, type, slot });
+    };
+
+    if (GLEW_VERSION_4_3 || GLEW_ARB_program_interface_query)
+    {
+        // 1. the program interface queries (GL 4.3): every resource with its properties at once
+        GLint count = 0;
+        glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const GLenum props[3] = { GL_NAME_LENGTH, GL_TYPE, GL_LOCATION };
+            GLint values[3];
+            glGetProgramResourceiv(ID, GL_UNIFORM, i, 3, props, 3, NULL, values);
+            name.resize(std::max<std::size_t>(name.size(), values[0]));
+            glGetProgramResourceName(ID, GL_UNIFORM, i, name.size(), NULL, &name[0]);
+            addUniform(&name[0], values[2], values[1]);
+        }
+        glGetProgramInterfaceiv(ID, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const GLenum props[2] = { GL_NAME_LENGTH, GL_LOCATION };
+            GLint values[2];
+            glGetProgramResourceiv(ID, GL_PROGRAM_INPUT, i, 2, props, 2, NULL, values);
+            name.resize(std::max<std::size_t>(name.size(), values[0]));
+            glGetProgramResourceName(ID, GL_PROGRAM_INPUT, i, name.size(), NULL, &name[0]);
+            attributes[&name[0]] = values[1];
+        }
+        glGetProgramInterfaceiv(ID, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const GLenum props[2] = { GL_NAME_LENGTH, GL_BUFFER_DATA_SIZE };
+            GLint values[2];
+            glGetProgramResourceiv(ID, GL_UNIFORM_BLOCK, i, 2, props, 2, NULL, values);
+            name.resize(std::max<std::size_t>(name.size(), values[0]));
+            glGetProgramResourceName(ID, GL_UNIFORM_BLOCK, i, name.size(), NULL, &name[0]);
+            blocks[&name[0]] = values[1];
+        }
+    }
+    else
+    {
+        // 2. the older per-kind queries
+        GLint count = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(ID, i, name.size(), NULL, &size, &type, &name[0]);
+            addUniform(&name[0], glGetUniformLocation(ID, &name[0]), type);
+        }
+        glGetProgramiv(ID, GL_ACTIVE_ATTRIBUTES, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint size;
+            GLenum type;
+            glGetActiveAttrib(ID, i, name.size(), NULL, &size, &type, &name[0]);
+            attributes[&name[0]] = glGetAttribLocation(ID, &name[0]);
+        }
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint size;
+            glGetActiveUniformBlockName(ID, i, name.size(), NULL, &name[0]);
+            glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+            blocks[&name[0]] = size;
+        }
+    }
+
+    shadow.assign(uniforms.size() * SHADER_SHADOW_SIZE, 0);
+    shadowValid.assign(uniforms.size(), 0);
+}
+
+bool Shader::hasAttribute(const char* name) const
+{
+    return attributes.count(name) > 0;
+}
+
+int Shader::blockSize(const char* name) const
+{
+    auto found = blocks.find(name);
+    return found == blocks.end() ? -1 : found->second;
+}
+
+template <typename T>
+Uniform<T> Shader::uniform(const std::string& name)
+{
+    static_assert(sizeof(T) <= SHADER_SHADOW_SIZE, "uniform too large for its shadow copy");
+    Uniform<T> handle;
+    auto found = uniforms.find(name);
+    if (found == uniforms.end())
+        return handle;
+    if (!UniformTraits<T>::accepts(found->second.type))
+    {
+        std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH::" << name << std::endl;
+        return handle;
+    }
+    handle.location = found->second.location;
+    handle.slot = found->second.slot;
+    return handle;
+}
+
+template <typename T>
+void Shader::set(const Uniform<T>& handle, const T& value)
+{
+    if (!handle.valid())
+        return;
+    // the program keeps its uniform values, so an equal value needs no upload
+    unsigned char* copy = &shadow[handle.slot * SHADER_SHADOW_SIZE];
+    if (shadowValid[handle.slot] && std::memcmp(copy, &value, sizeof(T)) == 0)
+        return;
+    std::memcpy(copy, &value, sizeof(T));
+    shadowValid[handle.slot] = 1;
+    UniformTraits<T>::upload(ID, handle.location, value);
+}
+
+void Shader::setBool(const std::string &name, bool value)
+{
+    set(uniform<bool>(name), value);
+}
+
+void Shader::setInt(const std::string &name, int value)
+{
+    set(uniform<int>(name), value);
+}
+
+void Shader::setFloat(const std::string &name, float value)
+{
+    set(uniform<float>(name), value);
+}
+
+void Shader::setVec3(const std::string &name, float x, float y, float z)
+{
+    set(uniform<glm::vec3>(name), glm::vec3(x, y, z));
+}
+
+void Shader::setVec3(const std::string &name, glm::vec3 pos)
+{
+    set(uniform<glm::vec3>(name), pos);
+}
+
+bool enableParallelShaderCompile()
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    // 0xFFFFFFFF leaves the number of threads to the driver
+    if (GLEW_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    else if (GLEW_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+    else
+        return false;
+    return true;
 }
 
-void Shader::setInt(const std::string &name, int value) const
+bool programBinarySupported()
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+        return false;
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
 }
 
-void Shader::setFloat(const std::string &name, float value) const
+// FNV-1a over both sources and the strings naming the driver
+uint64_t programKey(const std::string& vertexCode, const std::string& fragmentCode)
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&](const char* bytes, std::size_t size)
+    {
+        for (std::size_t i = 0; i < size; i++)
+            hash = (hash ^ (unsigned char)bytes[i]) * 1099511628211ull;
+        // a separator, so moving text between the parts changes the key
+        hash = (hash ^ 0xff) * 1099511628211ull;
+    };
+    add(vertexCode.data(), vertexCode.size());
+    add(fragmentCode.data(), fragmentCode.size());
+    const GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (GLenum name : names)
+    {
+        const char* value = (const char*)glGetString(name);
+        if (value != NULL)
+            add(value, std::strlen(value));
+    }
+    return hash;
 }
 
-void Shader::setVec3(const std::string &name, float x, float y, float z) const
+bool readProgramBinary(unsigned int program, const char* path, uint64_t key)
 {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+    FileIOSystem files;
+    std::string data;
+    if (!files.exists(path) || !files.readAll(path, data))
+        return false;
+
+    // header: magic, version, key, binary format
+    uint32_t version, format;
+    uint64_t fileKey;
+    std::size_t headerSize = 4 + sizeof(version) + sizeof(fileKey) + sizeof(format);
+    if (data.size() <= headerSize || data.compare(0, 4, "PBIN") != 0)
+        return false;
+    std::memcpy(&version, &data[4], sizeof(version));
+    std::memcpy(&fileKey, &data[8], sizeof(fileKey));
+    std::memcpy(&format, &data[16], sizeof(format));
+    if (version != 1 || fileKey != key)
+        return false;
+    glProgramBinary(program, format, &data[headerSize], data.size() - headerSize);
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success != 0;
 }
 
-void Shader::setVec3(const std::string &name, glm::vec3 pos) const
+bool writeProgramBinary(unsigned int program, const char* path, uint64_t key)
 {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), pos.x, pos.y, pos.z);
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+    {
+        std::cout << "ERROR::SHADER::BINARY_NOT_SUCCESSFULLY_WRITTEN" << std::endl;
+        return false;
+    }
+    uint32_t version = 1, fileFormat = format;
+    out.write("PBIN", 4);
+    out.write((const char*)&version, sizeof(version));
+    out.write((const char*)&key, sizeof(key));
+    out.write((const char*)&fileFormat, sizeof(fileFormat));
+    out.write(binary.data(), length);
+    return (bool)out;
 }
 
-#endif
\ No newline at end of file
+#endif
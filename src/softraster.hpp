@@ -0,0 +1,400 @@
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+#include <glm/glm.hpp>
+#include <stb/stb_image_write.h>
+
+#include "mesh.hpp"
+#include "threadpool.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// the object shaders of the viewer (flat, gouraud, phong and depth .vs/.fs)
+enum ShadingModel
+{
+    SHADING_FLAT,
+    SHADING_GOURAUD,
+    SHADING_PHONG,
+    SHADING_DEPTH
+};
+
+// the uniforms helloTriangle.cpp sets for the object shaders
+struct ShadingUniforms
+{
+    glm::mat4 model, view, projection;
+    glm::vec3 lightPos, viewPos, objectColor, lightColor;
+};
+
+// triangles per work item of the setup stage; every chunk bins into its own per-tile lists,
+// which the tiles then walk in chunk order, so triangles are drawn in submission order
+const std::size_t RASTER_CHUNK = 2048;
+
+// renders meshes on the CPU with the same results as the GL shaders: vertices are shaded in
+// parallel, triangles are clipped at the near plane, set up and binned into screen tiles, and
+// the tiles are rasterized in parallel with edge functions and a depth test (GL_LESS), each
+// tile owning its part of the color and depth buffers
+class SoftwareRasterizer
+{
+public:
+    int width, height;
+    int tileSize;
+    std::vector<unsigned char> color; // RGB, bottom row first like the GL framebuffer
+    std::vector<float> depth;         // window space depth
+
+    SoftwareRasterizer(int width, int height, int tileSize = 64);
+    void clear(const glm::vec3& clearColor);
+    // draws an indexed mesh (Mesh::buildIndices) on the pool (the default one when NULL)
+    void draw(const Mesh& mesh, const ShadingUniforms& uniforms, ShadingModel shading, ThreadPool* pool = NULL);
+    bool writePNG(const char* path) const;
+private:
+    // the vertex shader outputs; varying holds the normal (flat, phong) or the color (gouraud),
+    // occlusion the baked ambient occlusion (1 when the mesh has none)
+    struct ShadedVertex
+    {
+        glm::vec4 clip;
+        glm::vec3 world;
+        glm::vec3 varying;
+        float occlusion;
+    };
+    struct ScreenTriangle
+    {
+        glm::vec2 p[3];       // window coordinates, counter-clockwise
+        float z[3];           // window depth
+        float invW[3];
+        glm::vec3 world[3];
+        glm::vec3 varying[3];
+        float occlusion[3];
+        glm::vec3 flatNormal; // the provoking (last) vertex's normal and occlusion
+        float flatOcclusion;
+        int minX, minY, maxX, maxY;
+        float area;
+    };
+    struct Chunk
+    {
+        std::vector<ScreenTriangle> triangles;
+        std::vector<std::vector<unsigned int>> bins; // triangles per tile
+    };
+
+    // near plane clipping, window transform and binning of one triangle
+    void setupTriangle(Chunk& chunk, const ShadedVertex* v[3], const ShadedVertex& provoking);
+    void addTriangle(Chunk& chunk, const ShadedVertex v[3], const ShadedVertex& provoking);
+    void rasterizeTile(int tile, ShadingModel shading, const ShadingUniforms& uniforms);
+
+    int tilesX, tilesY;
+    std::vector<ShadedVertex> vertices;
+    std::vector<unsigned int> indices; // triangle corners as absolute vertex indices
+    std::vector<Chunk> chunks;
+};
+
+// lighting of flat.fs / phong.fs (and per vertex of gouraud.vs)
+glm::vec3 shadeFragment(const glm::vec3& normal, const glm::vec3& fragPos, float occlusion, const ShadingUniforms& u)
+{
+    // ambient component calculation
+    glm::vec3 ambient = 0.1f * occlusion * u.lightColor;
+
+    // diffuse component calculation
+    glm::vec3 norm = glm::normalize(normal);
+    glm::vec3 lightDir = glm::normalize(u.lightPos - fragPos);
+    float diff = std::max(glm::dot(norm, -lightDir), 0.0f);
+    glm::vec3 diffuse = diff * u.lightColor;
+
+    // specular component calculation
+    glm::vec3 viewDir = glm::normalize(u.viewPos - fragPos);
+    glm::vec3 reflectDir = glm::reflect(-lightDir, norm);
+    float spec = std::pow(std::max(glm::dot(viewDir, reflectDir), 0.0f), 32.0f);
+    glm::vec3 specular = 0.5f * spec * u.lightColor;
+
+    return (ambient + diffuse + specular) * u.objectColor;
+}
+
+// the gray level of depth.fs for a window space depth
+float shadeDepth(float depth)
+{
+    const float near = 0.1f, far = 100.0f;
+    float z = depth * 2.0f - 1.0f;
+    return (2.0f * near * far) / (far + near - z * (far - near)) / far;
+}
+
+SoftwareRasterizer::SoftwareRasterizer(int width, int height, int tileSize)
+{
+    this->width = width;
+    this->height = height;
+    this->tileSize = tileSize;
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+    color.resize(width * height * 3);
+    depth.resize(width * height);
+    clear(glm::vec3(0.0f));
+}
+
+void SoftwareRasterizer::clear(const glm::vec3& clearColor)
+{
+    unsigned char rgb[3];
+    for (int c = 0; c < 3; c++)
+        rgb[c] = (unsigned char)std::lround(glm::clamp(clearColor[c], 0.0f, 1.0f) * 255.0f);
+    for (std::size_t i = 0; i < depth.size(); i++)
+    {
+        color[i * 3] = rgb[0];
+        color[i * 3 + 1] = rgb[1];
+        color[i * 3 + 2] = rgb[2];
+    }
+    std::fill(depth.begin(), depth.end(), 1.0f);
+}
+
+void SoftwareRasterizer::draw(const Mesh& mesh, const ShadingUniforms& uniforms, ShadingModel shading, ThreadPool* pool)
+{
+    unsigned int step = mesh.stride();
+    if (mesh.submeshes.empty())
+    {
+        std::cout << "ERROR::SOFTRASTER::MESH_NOT_INDEXED" << std::endl;
+        return;
+    }
+    if (step == 1 && shading != SHADING_DEPTH)
+    {
+        std::cout << "ERROR::SOFTRASTER::LIGHTING_NEEDS_NORMALS" << std::endl;
+        return;
+    }
+    if (pool == NULL)
+        pool = defaultThreadPool();
+    unsigned int vertexCount = mesh.indexedVertices.size() / step;
+    glm::mat4 viewProjection = uniforms.projection * uniforms.view;
+    glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(uniforms.model)));
+
+    // 1. vertex shaders
+    vertices.resize(vertexCount);
+    auto shadeVertices = [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t i = first; i < last; i++)
+        {
+            ShadedVertex& v = vertices[i];
+            glm::vec4 world = uniforms.model * glm::vec4(mesh.indexedVertices[i * step], 1.0f);
+            v.clip = viewProjection * world;
+            v.world = glm::vec3(world);
+            v.occlusion = i < mesh.occlusion.size() ? mesh.occlusion[i] / 255.0f : 1.0f;
+            if (shading == SHADING_DEPTH)
+                continue;
+            v.varying = normalMatrix * mesh.indexedVertices[i * step + 1];
+            if (shading == SHADING_GOURAUD)
+                v.varying = shadeFragment(v.varying, v.world, v.occlusion, uniforms);
+        }
+    };
+    pool->parallelFor(vertexCount, TRANSFORM_CHUNK, shadeVertices);
+
+    // 2. the corners of every triangle as absolute vertex indices
+    indices.clear();
+    for (const SubMesh& sub : mesh.submeshes)
+        for (unsigned int k = sub.firstIndex; k < sub.firstIndex + sub.indexCount; k++)
+            indices.push_back((mesh.indexType == GL_UNSIGNED_SHORT ? mesh.shortIndices[k] : mesh.longIndices[k]) + sub.baseVertex);
+
+    // 3. triangle setup and binning, one set of bins per chunk
+    std::size_t triangleCount = indices.size() / 3;
+    chunks.resize((triangleCount + RASTER_CHUNK - 1) / RASTER_CHUNK);
+    auto setup = [&](std::size_t first, std::size_t last)
+    {
+        Chunk& chunk = chunks[first / RASTER_CHUNK];
+        chunk.triangles.clear();
+        chunk.bins.resize(tilesX * tilesY);
+        for (std::vector<unsigned int>& bin : chunk.bins)
+            bin.clear();
+        for (std::size_t t = first; t < last; t++)
+        {
+            const ShadedVertex* v[3] = { &vertices[indices[t * 3]], &vertices[indices[t * 3 + 1]], &vertices[indices[t * 3 + 2]] };
+            // flat shading takes the normal and occlusion of the last corner, like GL's provoking vertex
+            setupTriangle(chunk, v, *v[2]);
+        }
+    };
+    pool->parallelFor(triangleCount, RASTER_CHUNK, setup);
+
+    // 4. the tiles
+    auto rasterize = [&](std::size_t first, std::size_t last)
+    {
+        for (std::size_t tile = first; tile < last; tile++)
+            rasterizeTile(tile, shading, uniforms);
+    };
+    pool->parallelFor(tilesX * tilesY, 1, rasterize);
+}
+
+void SoftwareRasterizer::setupTriangle(Chunk& chunk, const ShadedVertex* v[3], const ShadedVertex& provoking)
+{
+    // 1. trivially rejected when all three corners are outside the same frustum plane
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (v[0]->clip[axis] > v[0]->clip.w && v[1]->clip[axis] > v[1]->clip.w && v[2]->clip[axis] > v[2]->clip.w)
+            return;
+        if (v[0]->clip[axis] < -v[0]->clip.w && v[1]->clip[axis] < -v[1]->clip.w && v[2]->clip[axis] < -v[2]->clip.w)
+            return;
+    }
+
+    // 2. entirely in front of the near plane: as is
+    auto inside = [](const ShadedVertex& p) { return p.clip.z + p.clip.w; };
+    if (inside(*v[0]) >= 0.0f && inside(*v[1]) >= 0.0f && inside(*v[2]) >= 0.0f)
+    {
+        ShadedVertex corners[3] = { *v[0], *v[1], *v[2] };
+        addTriangle(chunk, corners, provoking);
+        return;
+    }
+
+    // 3. clip against the near plane (z = -w) and fan the polygon out
+    ShadedVertex polygon[4];
+    int count = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        const ShadedVertex& a = *v[i];
+        const ShadedVertex& b = *v[(i + 1) % 3];
+        float da = inside(a), db = inside(b);
+        if (da >= 0.0f)
+            polygon[count++] = a;
+        if ((da >= 0.0f) != (db >= 0.0f))
+        {
+            float t = da / (da - db);
+            ShadedVertex& p = polygon[count++];
+            p.clip = a.clip + t * (b.clip - a.clip);
+            p.world = a.world + t * (b.world - a.world);
+            p.varying = a.varying + t * (b.varying - a.varying);
+            p.occlusion = a.occlusion + t * (b.occlusion - a.occlusion);
+        }
+    }
+    for (int i = 1; i + 1 < count; i++)
+    {
+        ShadedVertex corners[3] = { polygon[0], polygon[i], polygon[i + 1] };
+        addTriangle(chunk, corners, provoking);
+    }
+}
+
+void SoftwareRasterizer::addTriangle(Chunk& chunk, const ShadedVertex v[3], const ShadedVertex& provoking)
+{
+    // 1. window coordinates (pixel centers at .5, y up like GL)
+    ScreenTriangle tri;
+    for (int i = 0; i < 3; i++)
+    {
+        float invW = 1.0f / v[i].clip.w;
+        tri.p[i] = glm::vec2((v[i].clip.x * invW * 0.5f + 0.5f) * width, (v[i].clip.y * invW * 0.5f + 0.5f) * height);
+        tri.z[i] = v[i].clip.z * invW * 0.5f + 0.5f;
+        tri.invW[i] = invW;
+        tri.world[i] = v[i].world;
+        tri.varying[i] = v[i].varying;
+        tri.occlusion[i] = v[i].occlusion;
+    }
+    tri.flatNormal = provoking.varying;
+    tri.flatOcclusion = provoking.occlusion;
+
+    // 2. no face culling (the viewer does not enable it), clockwise triangles are flipped
+    tri.area = (tri.p[1].x - tri.p[0].x) * (tri.p[2].y - tri.p[0].y) - (tri.p[1].y - tri.p[0].y) * (tri.p[2].x - tri.p[0].x);
+    if (!(std::abs(tri.area) > 0.0f))
+        return;
+    if (tri.area < 0.0f)
+    {
+        std::swap(tri.p[1], tri.p[2]);
+        std::swap(tri.z[1], tri.z[2]);
+        std::swap(tri.invW[1], tri.invW[2]);
+        std::swap(tri.world[1], tri.world[2]);
+        std::swap(tri.varying[1], tri.varying[2]);
+        std::swap(tri.occlusion[1], tri.occlusion[2]);
+        tri.area = -tri.area;
+    }
+
+    // 3. the pixels whose centers the bounds can cover, and the tiles they fall in
+    glm::vec2 lower = glm::min(glm::min(tri.p[0], tri.p[1]), tri.p[2]);
+    glm::vec2 upper = glm::max(glm::max(tri.p[0], tri.p[1]), tri.p[2]);
+    tri.minX = std::max(0, (int)std::ceil(lower.x - 0.5f));
+    tri.minY = std::max(0, (int)std::ceil(lower.y - 0.5f));
+    tri.maxX = std::min(width - 1, (int)std::floor(upper.x - 0.5f));
+    tri.maxY = std::min(height - 1, (int)std::floor(upper.y - 0.5f));
+    if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+        return;
+    unsigned int index = chunk.triangles.size();
+    chunk.triangles.push_back(tri);
+    for (int ty = tri.minY / tileSize; ty <= tri.maxY / tileSize; ty++)
+        for (int tx = tri.minX / tileSize; tx <= tri.maxX / tileSize; tx++)
+            chunk.bins[ty * tilesX + tx].push_back(index);
+}
+
+void SoftwareRasterizer::rasterizeTile(int tile, ShadingModel shading, const ShadingUniforms& uniforms)
+{
+    int tileX0 = tile % tilesX * tileSize, tileY0 = tile / tilesX * tileSize;
+    int tileX1 = std::min(tileX0 + tileSize, width) - 1, tileY1 = std::min(tileY0 + tileSize, height) - 1;
+    for (const Chunk& chunk : chunks)
+    {
+        for (unsigned int index : chunk.bins[tile])
+        {
+            const ScreenTriangle& tri = chunk.triangles[index];
+            int x0 = std::max(tri.minX, tileX0), x1 = std::min(tri.maxX, tileX1);
+            int y0 = std::max(tri.minY, tileY0), y1 = std::min(tri.maxY, tileY1);
+
+            // edge e is opposite corner e; the top-left rule decides which pixels on an edge belong
+            // to the triangle, so pixels on a shared edge are drawn exactly once
+            float stepX[3], stepY[3], rowStart[3];
+            bool topLeft[3];
+            for (int e = 0; e < 3; e++)
+            {
+                glm::vec2 a = tri.p[(e + 1) % 3], b = tri.p[(e + 2) % 3];
+                stepX[e] = -(b.y - a.y);
+                stepY[e] = b.x - a.x;
+                topLeft[e] = (b.y == a.y && b.x < a.x) || b.y < a.y;
+                rowStart[e] = (b.x - a.x) * (y0 + 0.5f - a.y) - (b.y - a.y) * (x0 + 0.5f - a.x);
+            }
+            float invArea = 1.0f / tri.area;
+
+            for (int y = y0; y <= y1; y++)
+            {
+                float edge[3] = { rowStart[0], rowStart[1], rowStart[2] };
+                for (int x = x0; x <= x1; x++)
+                {
+                    bool covered = true;
+                    for (int e = 0; e < 3; e++)
+                        covered = covered && (edge[e] > 0.0f || (edge[e] == 0.0f && topLeft[e]));
+                    if (covered)
+                    {
+                        float l0 = edge[0] * invArea, l1 = edge[1] * invArea, l2 = edge[2] * invArea;
+                        float z = l0 * tri.z[0] + l1 * tri.z[1] + l2 * tri.z[2];
+                        float& stored = depth[y * width + x];
+                        if (z < stored && z >= 0.0f && z <= 1.0f)
+                        {
+                            stored = z;
+                            // perspective correct interpolation of the varyings
+                            float p0 = l0 * tri.invW[0], p1 = l1 * tri.invW[1], p2 = l2 * tri.invW[2];
+                            float invSum = 1.0f / (p0 + p1 + p2);
+                            p0 *= invSum, p1 *= invSum, p2 *= invSum;
+                            glm::vec3 result;
+                            if (shading == SHADING_DEPTH)
+                                result = glm::vec3(shadeDepth(z));
+                            else if (shading == SHADING_GOURAUD)
+                                result = p0 * tri.varying[0] + p1 * tri.varying[1] + p2 * tri.varying[2];
+                            else
+                            {
+                                glm::vec3 fragPos = p0 * tri.world[0] + p1 * tri.world[1] + p2 * tri.world[2];
+                                glm::vec3 normal = shading == SHADING_FLAT ? tri.flatNormal : p0 * tri.varying[0] + p1 * tri.varying[1] + p2 * tri.varying[2];
+                                float occlusion = shading == SHADING_FLAT ? tri.flatOcclusion : p0 * tri.occlusion[0] + p1 * tri.occlusion[1] + p2 * tri.occlusion[2];
+                                result = shadeFragment(normal, fragPos, occlusion, uniforms);
+                            }
+                            unsigned char* out = &color[(y * width + x) * 3];
+                            for (int c = 0; c < 3; c++)
+                                out[c] = (unsigned char)std::lround(glm::clamp(result[c], 0.0f, 1.0f) * 255.0f);
+                        }
+                    }
+                    for (int e = 0; e < 3; e++)
+                        edge[e] += stepX[e];
+                }
+                for (int e = 0; e < 3; e++)
+                    rowStart[e] += stepY[e];
+            }
+        }
+    }
+}
+
+bool SoftwareRasterizer::writePNG(const char* path) const
+{
+    // PNG rows go top to bottom, the buffers bottom to top
+    int rowBytes = width * 3;
+    if (!stbi_write_png(path, width, height, 3, &color[(height - 1) * rowBytes], -rowBytes))
+    {
+        std::cout << "ERROR::SOFTRASTER::PNG_NOT_WRITTEN" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#endif
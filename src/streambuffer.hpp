@@ -0,0 +1,138 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <vector>
+#include <iostream>
+
+// a buffer that is rewritten every frame: the storage is allocated once and split into regions
+// that are written in turn, with a fence per region so the CPU never overwrites data the GPU
+// has not read yet. With GL 4.4 / ARB_buffer_storage the whole buffer stays persistently mapped,
+// otherwise each region is mapped unsynchronized (the fences do the synchronizing)
+class StreamBuffer
+{
+public:
+    unsigned int buffer;
+    bool persistent;
+    std::size_t regionSize; // in bytes
+    unsigned int regions;
+
+    StreamBuffer();
+    // allocates the storage, binds it to GL_ARRAY_BUFFER
+    void create(std::size_t regionSize, unsigned int regions = 3);
+    void destroy();
+    bool valid() const { return buffer != 0; }
+    // waits until the next region is free and returns where to write it (NULL if mapping failed)
+    void* map();
+    // finishes writing the region handed out by map() and returns its index
+    unsigned int unmap();
+    // marks a region as in use by the commands issued so far
+    void fence(unsigned int region);
+private:
+    char* mapped;  // the persistent mapping of the whole buffer
+    unsigned int current;
+    std::vector<GLsync> fences;
+};
+
+StreamBuffer::StreamBuffer()
+{
+    buffer = 0;
+    persistent = false;
+    regionSize = 0;
+    regions = 0;
+    mapped = NULL;
+    current = 0;
+}
+
+void StreamBuffer::create(std::size_t regionSize, unsigned int regions)
+{
+    destroy();
+    this->regionSize = regionSize;
+    this->regions = regions;
+    current = regions - 1;
+    fences.assign(regions, (GLsync)0);
+    persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, regionSize * regions, NULL, flags);
+        mapped = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, regionSize * regions, flags);
+        if (mapped == NULL)
+        {
+            // immutable storage cannot be respecified, start over with a plain buffer
+            std::cout << "ERROR::STREAMBUFFER::PERSISTENT_MAPPING_FAILED" << std::endl;
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            persistent = false;
+        }
+    }
+    if (!persistent)
+        glBufferData(GL_ARRAY_BUFFER, regionSize * regions, NULL, GL_STREAM_DRAW);
+}
+
+void StreamBuffer::destroy()
+{
+    for (GLsync& sync : fences)
+    {
+        if (sync)
+            glDeleteSync(sync);
+        sync = 0;
+    }
+    if (mapped)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        mapped = NULL;
+    }
+    if (buffer)
+        glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+void* StreamBuffer::map()
+{
+    // 1. wait for the GPU to finish with the draws that read the next region
+    current = (current + 1) % regions;
+    GLsync& sync = fences[current];
+    if (sync)
+    {
+        GLbitfield flags = 0;
+        while (glClientWaitSync(sync, flags, 1000000000) == GL_TIMEOUT_EXPIRED)
+            flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        glDeleteSync(sync);
+        sync = 0;
+    }
+
+    // 2. hand out the region
+    if (persistent)
+        return mapped + regionSize * current;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    return glMapBufferRange(GL_ARRAY_BUFFER, regionSize * current, regionSize, access);
+}
+
+unsigned int StreamBuffer::unmap()
+{
+    if (!persistent)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    return current;
+}
+
+void StreamBuffer::fence(unsigned int region)
+{
+    if (fences[region])
+        glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+#endif
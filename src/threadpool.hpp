@@ -0,0 +1,165 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+// persistent worker threads for data-parallel loops: a job splits [0, count) into chunks that
+// the workers (and the thread waiting for the job) take from a shared counter, so dispatching
+// a job neither creates threads nor allocates
+class ThreadPool
+{
+public:
+    // threads counts the calling thread as well, 0 uses one thread per hardware thread
+    ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+    unsigned int size() const { return workers.size() + 1; }
+
+    // starts task(first, last) over the chunks of [0, count) and returns right away; task has
+    // to stay alive until wait() returns, and only one job can be in flight at a time
+    template <typename Task>
+    void dispatch(std::size_t count, std::size_t chunk, const Task& task);
+    // helps with the chunks that are left, then blocks until the job is done
+    void wait();
+    // dispatch and wait
+    template <typename Task>
+    void parallelFor(std::size_t count, std::size_t chunk, const Task& task);
+private:
+    struct Job
+    {
+        void (*run)(const void* task, std::size_t first, std::size_t last);
+        const void* task;
+        std::size_t count;
+        std::size_t chunk;
+    };
+    void start(const Job& job);
+    void work();
+    // runs chunks of the job until the counter is past its end
+    void runChunks(const Job& job);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, idle;
+    Job job;
+    std::atomic<std::size_t> next;
+    unsigned long long generation; // bumped for every job so sleeping workers notice it
+    unsigned int busy;              // workers still inside the current job
+    bool stopping;
+};
+
+// the pool shared by everything that does not bring its own
+ThreadPool* defaultThreadPool();
+
+ThreadPool::ThreadPool(unsigned int threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    job = Job{ NULL, NULL, 0, 1 };
+    next = 0;
+    generation = 0;
+    busy = 0;
+    stopping = false;
+    for (unsigned int i = 1; i < threads; i++)
+        workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+template <typename Task>
+void ThreadPool::dispatch(std::size_t count, std::size_t chunk, const Task& task)
+{
+    auto run = [](const void* task, std::size_t first, std::size_t last) { (*(const Task*)task)(first, last); };
+    start(Job{ run, &task, count, std::max<std::size_t>(chunk, 1) });
+}
+
+template <typename Task>
+void ThreadPool::parallelFor(std::size_t count, std::size_t chunk, const Task& task)
+{
+    dispatch(count, chunk, task);
+    wait();
+}
+
+void ThreadPool::start(const Job& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->job = job;
+        next = 0;
+        generation++;
+    }
+    wake.notify_all();
+}
+
+void ThreadPool::wait()
+{
+    Job current;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = job;
+    }
+    if (current.run)
+        runChunks(current);
+    // a worker that picked the job up may still be on its last chunk
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&]() { return busy == 0; });
+    job.run = NULL;
+}
+
+void ThreadPool::runChunks(const Job& job)
+{
+    while (true)
+    {
+        std::size_t first = next++ * job.chunk;
+        if (first >= job.count)
+            return;
+        job.run(job.task, first, std::min(job.count, first + job.chunk));
+    }
+}
+
+void ThreadPool::work()
+{
+    unsigned long long seen = 0;
+    while (true)
+    {
+        Job current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+            current = job;
+            if (current.run == NULL)
+                continue;
+            // counted while holding the lock, so wait() cannot return before this worker is done
+            busy++;
+        }
+        runChunks(current);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy--;
+        }
+        idle.notify_all();
+    }
+}
+
+ThreadPool* defaultThreadPool()
+{
+    static ThreadPool pool;
+    return &pool;
+}
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "layout.hpp"
+
+#include <vector>
+#include <cstddef>
+
+#if defined(__GNUC__) && defined(__SSE__)
+#define TRANSFORM_X86
+#include <immintrin.h>
+#endif
+
+// the CPU transform reads structure-of-arrays storage (see layout.hpp): one float per lane
+// instead of one vec3 per vertex, so 4 or 8 vertices load at once
+typedef VertexStorage<SoALayout> VertexSoA;
+
+// an object's model transform, composed as translation * rotation * scale, with a version
+// that changes whenever the composed matrix does, so consumers (the CPU transform, uploads)
+// can skip work while the object does not move. The parts are kept as a position, a unit
+// quaternion and per-axis factors rather than matrices: an update is a few multiplies instead
+// of a 4x4 product, and the quaternion is renormalized as it goes, so the rotation stays
+// orthonormal however long it is accumulated
+class TransformState
+{
+public:
+    TransformState();
+    // each part is accumulated like the glm function of the same name
+    void translate(const glm::vec3& offset);
+    void rotate(float radians, const glm::vec3& axis);
+    void scale(const glm::vec3& factors);
+    void reset();
+
+    // recomposed only after a part changed
+    const glm::mat4& model();
+    // bumped when model() returns a different matrix than before (never 0)
+    unsigned long long version();
+private:
+    void normalizeOrientation();
+
+    glm::vec3 position;
+    glm::quat orientation;
+    glm::vec3 scaling;
+    glm::mat4 composed;
+    // the last rotation step and its quaternion
+    float stepRadians;
+    glm::vec3 stepAxis;
+    glm::quat step;
+    unsigned int unnormalized; // rotations since the orientation was last renormalized
+    unsigned long long currentVersion;
+    bool dirty;
+};
+
+// translation * rotation * scale as one matrix (SSE where available)
+void composeTransform(const glm::vec3& position, const glm::quat& orientation, const glm::vec3& scaling, glm::mat4& out);
+
+// vertices per work item when a transform is split across threads: 2048 vertices read 24 and
+// write 24 bytes each, which keeps a chunk's input and output within a typical 256KB L2
+const std::size_t TRANSFORM_CHUNK = 2048;
+
+// transforms vertices [first, last) of in: positions by the affine transform, normals by its
+// normal matrix (inverse transpose of the upper 3x3), written interleaved with the given stride
+// in vec3s to out (out points at vertex 0); uses AVX2, SSE or scalar code depending on the CPU
+void transformVertices(const VertexSoA& in, std::size_t first, std::size_t last, const glm::mat4& transform,
+                       float* out, unsigned int stride);
+// the code path transformVertices takes on this machine
+const char* transformPath();
+
+TransformState::TransformState()
+{
+    currentVersion = 1;
+    stepRadians = 0.0f;
+    stepAxis = glm::vec3(0.0f);
+    step = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    unnormalized = 0;
+    reset();
+    composed = glm::mat4(1.0f);
+    dirty = false;
+}
+
+void TransformState::translate(const glm::vec3& offset)
+{
+    position += offset;
+    dirty = true;
+}
+
+void TransformState::rotate(float radians, const glm::vec3& axis)
+{
+    // a held key rotates by the same step every frame, so the step's sine and cosine are reused
+    if (radians != stepRadians || axis != stepAxis)
+    {
+        stepRadians = radians;
+        stepAxis = axis;
+        step = glm::angleAxis(radians, glm::normalize(axis));
+    }
+    orientation = orientation * step;
+    // the products' rounding error builds up in the quaternion's length, renormalize well before
+    // it is noticeable (model() does as well)
+    if (++unnormalized == 32)
+        normalizeOrientation();
+    dirty = true;
+}
+
+void TransformState::normalizeOrientation()
+{
+    // the length stays within a few ulps of 1, where one Newton step of 1 / sqrt(length^2)
+    // renormalizes without a sqrt
+    float length2 = glm::dot(orientation, orientation);
+    orientation *= (3.0f - length2) * 0.5f;
+    unnormalized = 0;
+}
+
+void TransformState::scale(const glm::vec3& factors)
+{
+    scaling *= factors;
+    dirty = true;
+}
+
+void TransformState::reset()
+{
+    position = glm::vec3(0.0f);
+    orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    scaling = glm::vec3(1.0f);
+    dirty = true;
+}
+
+const glm::mat4& TransformState::model()
+{
+    if (dirty)
+    {
+        // keys that cancel out (or did not change anything) keep the version
+        glm::mat4 next;
+        if (unnormalized > 0)
+            normalizeOrientation();
+        composeTransform(position, orientation, scaling, next);
+        if (next != composed)
+        {
+            composed = next;
+            currentVersion++;
+        }
+        dirty = false;
+    }
+    return composed;
+}
+
+unsigned long long TransformState::version()
+{
+    model();
+    return currentVersion;
+}
+
+void composeTransform(const glm::vec3& position, const glm::quat& orientation, const glm::vec3& scaling, glm::mat4& out)
+{
+#ifdef TRANSFORM_X86
+    // the rotation columns from products of the quaternion's components, 4 at a time
+    __m128 q = _mm_setr_ps(orientation.x, orientation.y, orientation.z, orientation.w);
+    __m128 noW = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    __m128 q2 = _mm_add_ps(q, q);
+    __m128 squares = _mm_mul_ps(q, q2);                                                            // 2xx 2yy 2zz 2ww
+    __m128 a = _mm_and_ps(_mm_shuffle_ps(squares, squares, _MM_SHUFFLE(3, 0, 0, 1)), noW);         // 2yy 2xx 2xx 0
+    __m128 b = _mm_and_ps(_mm_shuffle_ps(squares, squares, _MM_SHUFFLE(3, 1, 2, 2)), noW);         // 2zz 2zz 2yy 0
+    __m128 diagonal = _mm_sub_ps(_mm_sub_ps(_mm_setr_ps(1.0f, 1.0f, 1.0f, 0.0f), a), b);
+    __m128 cross = _mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 1, 0, 0)),
+                              _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 2, 1, 2)));                    // 2xz 2xy 2yz
+    __m128 wTerms = _mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 3, 3, 3)),
+                               _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 0, 2, 1)));                   // 2wy 2wz 2wx
+    __m128 sum = _mm_add_ps(cross, wTerms);                                                        // xz+wy xy+wz yz+wx
+    __m128 difference = _mm_sub_ps(cross, wTerms);                                                 // xz-wy xy-wz yz-wx
+    __m128 mixed = _mm_shuffle_ps(sum, difference, _MM_SHUFFLE(1, 0, 2, 1));
+    mixed = _mm_shuffle_ps(mixed, mixed, _MM_SHUFFLE(1, 3, 2, 0));                                 // xy+wz xz-wy xy-wz yz+wx
+    __m128 pair = _mm_shuffle_ps(sum, difference, _MM_SHUFFLE(2, 2, 0, 0));
+    pair = _mm_shuffle_ps(pair, pair, _MM_SHUFFLE(2, 0, 2, 0));                                    // xz+wy yz-wx
+    __m128 column0 = _mm_shuffle_ps(diagonal, mixed, _MM_SHUFFLE(1, 0, 3, 0));
+    column0 = _mm_shuffle_ps(column0, column0, _MM_SHUFFLE(1, 3, 2, 0));
+    __m128 column1 = _mm_shuffle_ps(diagonal, mixed, _MM_SHUFFLE(3, 2, 3, 1));
+    column1 = _mm_shuffle_ps(column1, column1, _MM_SHUFFLE(1, 3, 0, 2));
+    __m128 column2 = _mm_shuffle_ps(pair, diagonal, _MM_SHUFFLE(3, 2, 1, 0));
+
+    // scaled columns, then the translation
+    _mm_storeu_ps(&out[0][0], _mm_mul_ps(column0, _mm_set1_ps(scaling.x)));
+    _mm_storeu_ps(&out[1][0], _mm_mul_ps(column1, _mm_set1_ps(scaling.y)));
+    _mm_storeu_ps(&out[2][0], _mm_mul_ps(column2, _mm_set1_ps(scaling.z)));
+    _mm_storeu_ps(&out[3][0], _mm_setr_ps(position.x, position.y, position.z, 1.0f));
+#else
+    glm::mat3 rotation = glm::mat3_cast(orientation);
+    out = glm::mat4(glm::vec4(rotation[0] * scaling.x, 0.0f), glm::vec4(rotation[1] * scaling.y, 0.0f),
+                    glm::vec4(rotation[2] * scaling.z, 0.0f), glm::vec4(position, 1.0f));
+#endif
+}
+
+// the 12 affine and 9 normal matrix coefficients, row by row
+struct TransformRows
+{
+    float m[12];
+    float n[9];
+    TransformRows(const glm::mat4& transform)
+    {
+        glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(transform)));
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 4; c++)
+                m[r * 4 + c] = transform[c][r];
+            for (int c = 0; c < 3; c++)
+                n[r * 3 + c] = normal[c][r];
+        }
+    }
+};
+
+void transformScalar(const VertexSoA& in, std::size_t first, std::size_t last, const TransformRows& t,
+                     float* out, unsigned int stride)
+{
+    const float* m = t.m;
+    const float* n = t.n;
+    for (std::size_t i = first; i < last; i++)
+    {
+        float* v = out + i * stride * 3;
+        float x = in.px[i], y = in.py[i], z = in.pz[i];
+        v[0] = m[0] * x + m[1] * y + m[2] * z + m[3];
+        v[1] = m[4] * x + m[5] * y + m[6] * z + m[7];
+        v[2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+        if (stride == 2)
+        {
+            x = in.nx[i], y = in.ny[i], z = in.nz[i];
+            v[3] = n[0] * x + n[1] * y + n[2] * z;
+            v[4] = n[3] * x + n[4] * y + n[5] * z;
+            v[5] = n[6] * x + n[7] * y + n[8] * z;
+        }
+    }
+}
+
+#ifdef TRANSFORM_X86
+// writes 4 lanes of positions (and normals) as interleaved vec3s with 4-wide stores: each store
+// spills one float into the next vec3, which the following store overwrites, so the caller
+// has to keep one vertex after the 4 in reserve
+inline void storeVertices4(__m128 x, __m128 y, __m128 z, float* out, std::size_t step)
+{
+    __m128 w = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _mm_storeu_ps(out, x);
+    _mm_storeu_ps(out + step, y);
+    _mm_storeu_ps(out + step * 2, z);
+    _mm_storeu_ps(out + step * 3, w);
+}
+
+inline void storeVertices4(__m128 x, __m128 y, __m128 z, __m128 nx, __m128 ny, __m128 nz, float* out, std::size_t step)
+{
+    __m128 w = _mm_setzero_ps(), nw = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+    _MM_TRANSPOSE4_PS(nx, ny, nz, nw);
+    _mm_storeu_ps(out, x);
+    _mm_storeu_ps(out + 3, nx);
+    _mm_storeu_ps(out + step, y);
+    _mm_storeu_ps(out + step + 3, ny);
+    _mm_storeu_ps(out + step * 2, z);
+    _mm_storeu_ps(out + step * 2 + 3, nz);
+    _mm_storeu_ps(out + step * 3, w);
+    _mm_storeu_ps(out + step * 3 + 3, nw);
+}
+
+void transformSSE(const VertexSoA& in, std::size_t& first, std::size_t last, const TransformRows& t,
+                  float* out, unsigned int stride)
+{
+    __m128 m[12], n[9];
+    for (int k = 0; k < 12; k++)
+        m[k] = _mm_set1_ps(t.m[k]);
+    for (int k = 0; k < 9; k++)
+        n[k] = _mm_set1_ps(t.n[k]);
+    std::size_t step = stride * 3;
+
+    // the last vertex of the range is left for the scalar loop (see storeVertices4)
+    std::size_t i = first;
+    for (; i + 4 < last; i += 4)
+    {
+        float* v = out + i * step;
+        __m128 x = _mm_loadu_ps(&in.px[i]), y = _mm_loadu_ps(&in.py[i]), z = _mm_loadu_ps(&in.pz[i]);
+        __m128 tx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], x), _mm_mul_ps(m[1], y)), _mm_add_ps(_mm_mul_ps(m[2], z), m[3]));
+        __m128 ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[4], x), _mm_mul_ps(m[5], y)), _mm_add_ps(_mm_mul_ps(m[6], z), m[7]));
+        __m128 tz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[8], x), _mm_mul_ps(m[9], y)), _mm_add_ps(_mm_mul_ps(m[10], z), m[11]));
+        if (stride == 1)
+        {
+            storeVertices4(tx, ty, tz, v, step);
+            continue;
+        }
+        x = _mm_loadu_ps(&in.nx[i]), y = _mm_loadu_ps(&in.ny[i]), z = _mm_loadu_ps(&in.nz[i]);
+        __m128 sx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], x), _mm_mul_ps(n[1], y)), _mm_mul_ps(n[2], z));
+        __m128 sy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[3], x), _mm_mul_ps(n[4], y)), _mm_mul_ps(n[5], z));
+        __m128 sz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[6], x), _mm_mul_ps(n[7], y)), _mm_mul_ps(n[8], z));
+        storeVertices4(tx, ty, tz, sx, sy, sz, v, step);
+    }
+    first = i;
+}
+
+__attribute__((target("avx2,fma")))
+void transformAVX2(const VertexSoA& in, std::size_t& first, std::size_t last, const TransformRows& t,
+                   float* out, unsigned int stride)
+{
+    __m256 m[12], n[9];
+    for (int k = 0; k < 12; k++)
+        m[k] = _mm256_set1_ps(t.m[k]);
+    for (int k = 0; k < 9; k++)
+        n[k] = _mm256_set1_ps(t.n[k]);
+    std::size_t step = stride * 3;
+
+    std::size_t i = first;
+    for (; i + 8 < last; i += 8)
+    {
+        float* v = out + i * step;
+        __m256 x = _mm256_loadu_ps(&in.px[i]), y = _mm256_loadu_ps(&in.py[i]), z = _mm256_loadu_ps(&in.pz[i]);
+        __m256 tx = _mm256_fmadd_ps(m[0], x, _mm256_fmadd_ps(m[1], y, _mm256_fmadd_ps(m[2], z, m[3])));
+        __m256 ty = _mm256_fmadd_ps(m[4], x, _mm256_fmadd_ps(m[5], y, _mm256_fmadd_ps(m[6], z, m[7])));
+        __m256 tz = _mm256_fmadd_ps(m[8], x, _mm256_fmadd_ps(m[9], y, _mm256_fmadd_ps(m[10], z, m[11])));
+        if (stride == 1)
+        {
+            storeVertices4(_mm256_castps256_ps128(tx), _mm256_castps256_ps128(ty), _mm256_castps256_ps128(tz), v, step);
+            storeVertices4(_mm256_extractf128_ps(tx, 1), _mm256_extractf128_ps(ty, 1), _mm256_extractf128_ps(tz, 1), v + step * 4, step);
+            continue;
+        }
+        x = _mm256_loadu_ps(&in.nx[i]), y = _mm256_loadu_ps(&in.ny[i]), z = _mm256_loadu_ps(&in.nz[i]);
+        __m256 sx = _mm256_fmadd_ps(n[0], x, _mm256_fmadd_ps(n[1], y, _mm256_mul_ps(n[2], z)));
+        __m256 sy = _mm256_fmadd_ps(n[3], x, _mm256_fmadd_ps(n[4], y, _mm256_mul_ps(n[5], z)));
+        __m256 sz = _mm256_fmadd_ps(n[6], x, _mm256_fmadd_ps(n[7], y, _mm256_mul_ps(n[8], z)));
+        storeVertices4(_mm256_castps256_ps128(tx), _mm256_castps256_ps128(ty), _mm256_castps256_ps128(tz),
+                       _mm256_castps256_ps128(sx), _mm256_castps256_ps128(sy), _mm256_castps256_ps128(sz), v, step);
+        storeVertices4(_mm256_extractf128_ps(tx, 1), _mm256_extractf128_ps(ty, 1), _mm256_extractf128_ps(tz, 1),
+                       _mm256_extractf128_ps(sx, 1), _mm256_extractf128_ps(sy, 1), _mm256_extractf128_ps(sz, 1), v + step * 4, step);
+    }
+    first = i;
+}
+
+bool transformHasAVX2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return avx2;
+}
+#endif
+
+void transformVertices(const VertexSoA& in, std::size_t first, std::size_t last, const glm::mat4& transform,
+                       float* out, unsigned int stride)
+{
+    TransformRows rows(transform);
+#ifdef TRANSFORM_X86
+    // the vector loops stop short of the end of the range, the scalar loop finishes it
+    if (transformHasAVX2())
+        transformAVX2(in, first, last, rows, out, stride);
+    transformSSE(in, first, last, rows, out, stride);
+#endif
+    transformScalar(in, first, last, rows, out, stride);
+}
+
+const char* transformPath()
+{
+#ifdef TRANSFORM_X86
+    return transformHasAVX2() ? "AVX2" : "SSE";
+#else
+    return "scalar";
+#endif
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstring>
+#include <vector>
+
+// binding points of the uniform blocks every shader declares (layout (std140, binding = N))
+const unsigned int FRAME_BLOCK_BINDING = 0;
+const unsigned int OBJECT_BLOCK_BINDING = 1;
+
+// the Frame block in std140 layout (a vec3 takes the room of a vec4): camera and light, the
+// same for every program and every draw of a frame
+struct FrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 lightPos;
+    glm::vec4 lightColor;
+    glm::vec4 viewPos;
+};
+
+// the Object block in std140 layout (a mat3 is three vec4 columns)
+struct ObjectUniforms
+{
+    glm::mat4 model;
+    glm::vec4 normalMatrix[3];
+    glm::vec4 objectColor;
+
+    ObjectUniforms(const glm::mat4& model = glm::mat4(1.0f), const glm::vec3& color = glm::vec3(1.0f));
+};
+
+static_assert(sizeof(FrameUniforms) == 176, "FrameUniforms does not match the std140 Frame block");
+static_assert(sizeof(ObjectUniforms) == 128, "ObjectUniforms does not match the std140 Object block");
+
+// a uniform buffer holding one block; uploads are skipped while the contents do not change,
+// so objects that keep their own buffer only pay for binding it
+template <typename Block>
+class UniformBuffer
+{
+public:
+    unsigned int ID = 0;
+
+    void create();
+    // makes this the buffer the shaders' block at binding reads
+    void bind(unsigned int binding) const;
+    void upload(const Block& block);
+    void destroy();
+private:
+    Block last;
+    bool uploaded = false;
+};
+
+// many blocks in one buffer, each at an offset the driver accepts for glBindBufferRange; all of
+// them are uploaded together once per frame and a draw selects its own with bindEntry, instead
+// of rewriting one block between draws
+template <typename Block>
+class UniformArrayBuffer
+{
+public:
+    unsigned int ID = 0;
+    // bytes from one block to the next (sizeof(Block) rounded up to the offset alignment)
+    unsigned int stride = 0;
+    unsigned int count = 0;
+
+    void create(unsigned int count);
+    // makes entry i the block the shaders' block at binding reads
+    void bindEntry(unsigned int binding, unsigned int i) const;
+    // blocks beyond count are ignored
+    void upload(const std::vector<Block>& blocks);
+    void destroy();
+private:
+    std::vector<unsigned char> staging;
+    bool uploaded = false;
+};
+
+ObjectUniforms::ObjectUniforms(const glm::mat4& model, const glm::vec3& color)
+{
+    // the inverse transpose keeps normals perpendicular under non-uniform scaling; computed
+    // here once per draw instead of in the vertex shader once per vertex
+    this->model = model;
+    glm::mat3 normal = glm::transpose(glm::inverse(glm::mat3(model)));
+    for (int c = 0; c < 3; c++)
+        normalMatrix[c] = glm::vec4(normal[c], 0.0f);
+    objectColor = glm::vec4(color, 1.0f);
+}
+
+template <typename Block>
+void UniformBuffer<Block>::create()
+{
+    glGenBuffers(1, &ID);
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    uploaded = false;
+}
+
+template <typename Block>
+void UniformBuffer<Block>::bind(unsigned int binding) const
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+}
+
+template <typename Block>
+void UniformBuffer<Block>::upload(const Block& block)
+{
+    if (ID == 0 || (uploaded && std::memcmp(&last, &block, sizeof(Block)) == 0))
+        return;
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    last = block;
+    uploaded = true;
+}
+
+template <typename Block>
+void UniformBuffer<Block>::destroy()
+{
+    glDeleteBuffers(1, &ID);
+    ID = 0;
+    uploaded = false;
+}
+
+template <typename Block>
+void UniformArrayBuffer<Block>::create(unsigned int count)
+{
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT is 256 on most hardware
+    int alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = alignment > 0 ? alignment : 256;
+    stride = (sizeof(Block) + alignment - 1) / alignment * alignment;
+    this->count = count;
+    staging.assign((std::size_t)stride * count, 0);
+    glGenBuffers(1, &ID);
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferData(GL_UNIFORM_BUFFER, staging.size(), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    uploaded = false;
+}
+
+template <typename Block>
+void UniformArrayBuffer<Block>::bindEntry(unsigned int binding, unsigned int i) const
+{
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, ID, (GLintptr)i * stride, sizeof(Block));
+}
+
+template <typename Block>
+void UniformArrayBuffer<Block>::upload(const std::vector<Block>& blocks)
+{
+    if (ID == 0)
+        return;
+    // packed at their offsets, then one upload for all of them unless none changed
+    bool changed = !uploaded;
+    for (std::size_t i = 0; i < blocks.size() && i < count; i++)
+    {
+        unsigned char* entry = &staging[i * stride];
+        if (std::memcmp(entry, &blocks[i], sizeof(Block)) != 0)
+        {
+            std::memcpy(entry, &blocks[i], sizeof(Block));
+            changed = true;
+        }
+    }
+    if (!changed)
+        return;
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), staging.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    uploaded = true;
+}
+
+template <typename Block>
+void UniformArrayBuffer<Block>::destroy()
+{
+    glDeleteBuffers(1, &ID);
+    ID = 0;
+    uploaded = false;
+}
+
+#endif
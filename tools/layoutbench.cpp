@@ -0,0 +1,64 @@
+// compares the vertex storage layouts of layout.hpp on the CPU-side algorithms
+// usage: layoutbench [model] [minimum vertices]
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "../src/mesh.hpp"
+#include "../src/layout.hpp"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+
+// milliseconds per call of f, averaged over repeats
+template <typename F>
+double timeMs(int repeats, const F& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++)
+        f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / repeats;
+}
+
+template <typename Layout>
+void measure(const char* name, const VertexStorage<AoSLayout>& source, const glm::mat4& transform)
+{
+    const int repeats = 20;
+    VertexStorage<Layout> in, out;
+    glm::vec3 lower, upper;
+    double convert = timeMs(repeats, [&]() { convertLayout(source, in); });
+    transformLayout(in, transform, out);
+    double transformed = timeMs(repeats, [&]() { transformLayout(in, transform, out); });
+    double bounds = timeMs(repeats, [&]() { boundsLayout(out, lower, upper); });
+    double normalize = timeMs(repeats, [&]() { normalizeLayout(out); });
+    std::cout << name << "\t" << convert << "\t" << transformed << "\t" << bounds << "\t" << normalize
+              << "\t(" << lower.x + upper.x << ")" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::string model = argc > 1 ? argv[1] : "head.obj";
+    std::size_t minimumVertices = argc > 2 ? std::stoul(argv[2]) : 1000000;
+
+    // 1. load the model and repeat its vertices until the stream is big enough to time
+    FileIOSystem data("../data/");
+    Mesh mesh(model.c_str(), ATTRIB_POSITION | ATTRIB_NORMAL, &data);
+    mesh.buildIndices(false);
+    if (mesh.indexedVertices.empty())
+        return 1;
+    VertexStorage<AoSLayout> source;
+    source.stride = mesh.stride();
+    while (source.data.size() / source.stride < minimumVertices)
+        source.data.insert(source.data.end(), mesh.indexedVertices.begin(), mesh.indexedVertices.end());
+    source.count = source.data.size() / source.stride;
+    glm::mat4 transform = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f, -1.0f, 2.0f)), 0.7f, glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // 2. the same algorithms on every layout
+    std::cout << model << ": " << source.count << " vertices, ms per call" << std::endl;
+    std::cout << "layout\tconvert\ttransform\tbounds\tnormalize" << std::endl;
+    measure<AoSLayout>("AoS", source, transform);
+    measure<SoALayout>("SoA", source, transform);
+    measure<AoSoALayout<8>>("AoSoA8", source, transform);
+    return 0;
+}
@@ -0,0 +1,106 @@
+// measures the morph target blend with many weights active at once
+// usage: morphbench [base model] [target model] [synthetic targets]
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "../src/mesh.hpp"
+#include "../src/morph.hpp"
+#include "../src/threadpool.hpp"
+#include "../src/bvh.hpp"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+    std::string model = argc > 1 ? argv[1] : "head.obj";
+    std::string targetModel = argc > 2 ? argv[2] : "head_chord.obj";
+    unsigned int synthetic = argc > 3 ? std::stoul(argv[3]) : 64;
+
+    // 1. the base and the target shipped with it
+    FileIOSystem data("../data/");
+    Mesh base(model.c_str(), ATTRIB_POSITION | ATTRIB_NORMAL, &data);
+    base.buildIndices(false);
+    MorphSet morph;
+    if (!morph.setBase(base))
+        return 1;
+    Mesh target(targetModel.c_str(), ATTRIB_POSITION | ATTRIB_NORMAL, &data);
+    if (morph.addTarget(target, targetModel))
+        std::cout << targetModel << ": " << morph.targets.back().deltas.count << " of " << morph.base.count
+                  << " vertices differ from " << model << std::endl;
+
+    // 2. synthetic targets: bulges of a tenth of the model's size around vertices spread over it
+    unsigned int step = base.stride();
+    float radius = glm::length(base.largestVertex) * 0.1f;
+    for (unsigned int t = 0; t < synthetic; t++)
+    {
+        Mesh bulge = base;
+        glm::vec3 center = morph.base.position((std::size_t)t * 7919 % morph.base.count);
+        for (std::size_t c = 0; c < bulge.triangles.size(); c += step)
+        {
+            float distance = glm::length(bulge.triangles[c] - center);
+            if (distance < radius)
+                bulge.triangles[c] += (radius - distance) * 0.2f * (step == 2 ? bulge.triangles[c + 1] : glm::vec3(0.0f, 1.0f, 0.0f));
+        }
+        morph.addTarget(bulge, "bulge" + std::to_string(t));
+    }
+    std::cout << morph.targets.size() << " targets, " << morph.deltaCount() << " stored deltas ("
+              << morph.deltaCount() * 100.0 / (morph.base.count * morph.targets.size()) << "% of dense), "
+              << transformPath() << std::endl;
+
+    // 3. blend with more and more weights active (powers of two, then all of them)
+    std::vector<unsigned int> counts;
+    for (unsigned int active = 1; active < morph.targets.size(); active *= 2)
+        counts.push_back(active);
+    counts.push_back(morph.targets.size());
+    VertexSoA out;
+    ThreadPool* pool = defaultThreadPool();
+    for (unsigned int active : counts)
+    {
+        std::vector<float> weights(morph.targets.size(), 0.0f);
+        for (unsigned int t = 0; t < active; t++)
+            weights[t] = 0.5f / (t + 1);
+        morph.evaluate(weights, out, pool); // warm up
+
+        const int repeats = 100;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++)
+            morph.evaluate(weights, out, pool);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / repeats;
+        std::cout << active << " weights: " << ms << " ms per frame (" << pool->size() << " threads)" << std::endl;
+    }
+
+    // 4. keeping a BVH of the blend up to date: refit against rebuild, with all weights swinging
+    DynamicBVH dynamic;
+    dynamic.build(base, pool);
+    const int frames = 100;
+    double refitMs = 0.0, rebuildMs = 0.0;
+    for (int f = 0; f < frames; f++)
+    {
+        std::vector<float> weights(morph.targets.size());
+        for (unsigned int t = 0; t < weights.size(); t++)
+            weights[t] = 0.5f + 0.5f * std::sin(f * 0.1f * (1.0f + 0.3f * t));
+        morph.evaluate(weights, out, pool);
+        auto start = std::chrono::steady_clock::now();
+        dynamic.update(out, pool);
+        refitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (f % 10 == 0)
+        {
+            // the same tree built from scratch every frame, for comparison
+            Mesh blended = base;
+            for (std::size_t v = 0; v < out.count; v++)
+                blended.indexedVertices[v * step] = out.position(v);
+            blended.triangles.clear();
+            BVH rebuilt;
+            start = std::chrono::steady_clock::now();
+            rebuilt.build(blended, pool);
+            rebuildMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() * 10.0;
+        }
+    }
+    std::cout << "BVH of the blend (" << dynamic.bvh().corners.size() / 3 << " triangles): refit " << refitMs / frames << " ms, rebuild "
+              << rebuildMs / frames << " ms per frame, SAH cost " << dynamic.costRatio() << "x the last build's, "
+              << dynamic.rebuilds << " background rebuilds" << std::endl;
+    return 0;
+}
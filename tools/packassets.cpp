@@ -0,0 +1,169 @@
+// offline asset compiler: turns a directory of loose assets into one mappable pack
+// usage: packassets <asset directory> <output pack> [threads]
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "../src/mesh.hpp"
+#include "../src/iosystem.hpp"
+#include "../src/optimize.hpp"
+#include "../src/pack.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <filesystem>
+
+struct Job
+{
+    std::string file;     // source file name in the asset directory
+    std::string name;     // entry name in the pack
+    uint64_t hash;
+    PackKind kind;
+    bool reused;
+    std::vector<char> blob;
+};
+
+// parse, triangulate, generate missing normals, index, optimize for the vertex cache
+std::vector<char> compileMesh(const std::string& file, IOSystem* io)
+{
+    Mesh mesh(file.c_str(), ATTRIB_POSITION | ATTRIB_NORMAL, io);
+    if (mesh.normals.empty())
+        mesh.generateNormals();
+
+    // weld into a single range first so the optimizer sees the whole mesh
+    mesh.buildIndices(false);
+    std::vector<unsigned int> ids;
+    if (mesh.indexType == GL_UNSIGNED_SHORT)
+        ids.assign(mesh.shortIndices.begin(), mesh.shortIndices.end());
+    else
+        ids = mesh.longIndices;
+    unsigned int step = mesh.stride();
+    optimizeVertexCache(ids, mesh.indexedVertices.size() / step);
+
+    // re-index in the optimized triangle order (which also puts vertices in first-use order)
+    std::vector<glm::vec3> ordered;
+    ordered.reserve(ids.size() * step);
+    for (unsigned int id : ids)
+        for (unsigned int k = 0; k < step; k++)
+            ordered.push_back(mesh.indexedVertices[id * step + k]);
+    mesh.triangles.swap(ordered);
+    mesh.buildIndices(true);
+    return PackBuilder::serializeMesh(mesh);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "usage: packassets <asset directory> <output pack> [threads]" << std::endl;
+        return 1;
+    }
+    std::string directory = argv[1];
+    if (!directory.empty() && directory.back() != '/' && directory.back() != '\\')
+        directory += '/';
+    std::string packPath = argv[2];
+    unsigned int threads = argc > 3 ? std::stoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    auto start = std::chrono::steady_clock::now();
+
+    // 1. gather the loose assets (generated files are left out)
+    std::vector<Job> jobs;
+    for (const auto& item : std::filesystem::directory_iterator(directory))
+    {
+        if (!item.is_regular_file())
+            continue;
+        std::string file = item.path().filename().string();
+        std::string ext = item.path().extension().string();
+        if (ext == ".pack" || ext == ".tmp" || ext == ".pm" || ext == ".ao" || ext == ".zip")
+            continue;
+        Job job;
+        job.file = file;
+        job.name = file;
+        job.kind = PACK_RAW;
+        if (ext == ".obj")
+            job.kind = PACK_MESH;
+        else if (ext == ".gz" && file.size() > 7 && file.compare(file.size() - 7, 7, ".obj.gz") == 0)
+        {
+            job.kind = PACK_MESH;
+            job.name = file.substr(0, file.size() - 3);
+        }
+        job.hash = 0;
+        job.reused = false;
+        jobs.push_back(job);
+    }
+    // model.obj and model.obj.gz share an entry name, the uncompressed source wins
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b)
+    {
+        return a.name != b.name ? a.name < b.name : a.file.size() < b.file.size();
+    });
+    jobs.erase(std::unique(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.name == b.name; }), jobs.end());
+
+    // 2. compile in parallel, reusing blobs whose source hash matches the previous pack
+    MMapIOSystem io(directory);
+    {
+        AssetPack previous(packPath.c_str());
+        std::atomic<std::size_t> next(0);
+        auto work = [&]()
+        {
+            for (std::size_t i = next++; i < jobs.size(); i = next++)
+            {
+                Job& job = jobs[i];
+                IOStream* source = io.open(job.file.c_str());
+                if (source == NULL)
+                    continue;
+                std::vector<char> bytes;
+                if (source->data() == NULL)
+                {
+                    bytes.resize(source->fileSize());
+                    source->read(bytes.data(), 1, bytes.size());
+                }
+                const char* data = source->data() ? source->data() : bytes.data();
+                job.hash = packHash(data, source->fileSize()) ^ job.kind;
+
+                const PackEntry* old = previous.valid() ? previous.find(job.name.c_str()) : NULL;
+                if (old && old->hash == job.hash && old->kind == (uint32_t)job.kind)
+                {
+                    job.blob.assign(previous.blob(*old), previous.blob(*old) + old->size);
+                    job.reused = true;
+                }
+                else if (job.kind == PACK_MESH)
+                    job.blob = compileMesh(job.file, &io);
+                else
+                    job.blob.assign(data, data + source->fileSize());
+                io.close(source);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; t++)
+            workers.emplace_back(work);
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    // 3. write to a temporary file and swap it in (the previous pack is unmapped by now)
+    PackBuilder builder;
+    std::size_t reused = 0;
+    for (Job& job : jobs)
+    {
+        reused += job.reused;
+        builder.add(job.name, job.hash, job.kind, std::move(job.blob));
+    }
+    std::string tmpPath = packPath + ".tmp";
+    if (!builder.write(tmpPath.c_str()))
+        return 1;
+    std::remove(packPath.c_str());
+    if (std::rename(tmpPath.c_str(), packPath.c_str()) != 0)
+    {
+        std::cout << "ERROR::PACK::RENAME_FAILED" << std::endl;
+        return 1;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "packed " << jobs.size() << " assets (" << jobs.size() - reused << " compiled, " << reused
+              << " unchanged) with " << threads << " threads in " << elapsed.count() << "s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,104 @@
+// renders a model without a GPU, with the viewer's camera, light and shading, to a PNG, and
+// measures frames per second with 1 to N threads
+// usage: softrender [model] [flat|gouraud|phong|depth] [output.png] [width] [height] [frames]
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "../src/mesh.hpp"
+#include "../src/pack.hpp"
+#include "../src/transform.hpp"
+#include "../src/threadpool.hpp"
+#include "../src/softraster.hpp"
+#include "../src/ambient.hpp"
+// the PNG writer's implementation, once (softraster.hpp only declares it)
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
+
+#include <string>
+#include <thread>
+#include <chrono>
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+    std::string model = argc > 1 ? argv[1] : "shark.obj";
+    std::string mode = argc > 2 ? argv[2] : "phong";
+    std::string output = argc > 3 ? argv[3] : "softrender.png";
+    int width = argc > 4 ? std::stoi(argv[4]) : 800;
+    int height = argc > 5 ? std::stoi(argv[5]) : 600;
+    int frames = argc > 6 ? std::stoi(argv[6]) : 20;
+
+    ShadingModel shading = SHADING_PHONG;
+    if (mode == "flat")
+        shading = SHADING_FLAT;
+    else if (mode == "gouraud")
+        shading = SHADING_GOURAUD;
+    else if (mode == "depth")
+        shading = SHADING_DEPTH;
+
+    // 1. the model, from the asset pack when it is there
+    FileIOSystem data("../data/");
+    AssetPack pack("../data/assets.pack");
+    Mesh mesh;
+    if (!pack.valid() || !pack.loadMesh(model.c_str(), mesh))
+    {
+        mesh = Mesh(model.c_str(), shading == SHADING_DEPTH ? ATTRIB_POSITION : ATTRIB_POSITION | ATTRIB_NORMAL, &data);
+        mesh.buildIndices();
+    }
+    if (mesh.submeshes.empty())
+        return 1;
+    // the viewer's baked ambient occlusion (64 rays), baked here when it has not been yet
+    if (mesh.stride() == 2)
+    {
+        std::string aoPath = "../data/" + model.substr(0, model.rfind(".obj")) + ".ao";
+        if (!readAmbientOcclusion(mesh, aoPath.c_str(), 64) && bakeAmbientOcclusion(mesh, 64))
+            writeAmbientOcclusion(mesh, aoPath.c_str(), 64);
+    }
+
+    // 2. the uniforms and the initial transform of helloTriangle.cpp
+    TransformState objectTransform;
+    objectTransform.scale(glm::vec3(1.0 / glm::length(mesh.largestVertex)));
+    if (shading == SHADING_DEPTH)
+    {
+        objectTransform.scale(glm::vec3(20.0));
+        objectTransform.translate(glm::vec3(0.0, 0.0, -50.0));
+    }
+    ShadingUniforms uniforms;
+    uniforms.view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f));
+    uniforms.projection = glm::perspective(glm::radians(45.0f), (float)width / height, 0.1f, 100.0f);
+    uniforms.lightPos = glm::vec3(-1.8f, -1.5f, -3.0f);
+    uniforms.viewPos = glm::vec3(0.0f, 0.0f, -3.0f);
+    uniforms.objectColor = glm::vec3(1.0f, 0.5f, 0.5f);
+    uniforms.lightColor = glm::vec3(1.0f, 1.0f, 1.0f);
+
+    SoftwareRasterizer rasterizer(width, height);
+    uniforms.model = objectTransform.model();
+    rasterizer.clear(glm::vec3(0.2f, 0.2f, 0.3f));
+    rasterizer.draw(mesh, uniforms, shading);
+    if (!rasterizer.writePNG(output.c_str()))
+        return 1;
+    std::cout << model << " (" << mesh.indexedVertices.size() / mesh.stride() << " vertices), " << mode << ", "
+              << width << "x" << height << " -> " << output << std::endl;
+
+    // 3. the model turning a little every frame, on pools of 1 to N threads
+    unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    double single = 0.0;
+    for (unsigned int threads = 1; threads <= maxThreads; threads++)
+    {
+        ThreadPool pool(threads);
+        TransformState turning = objectTransform;
+        auto start = std::chrono::steady_clock::now();
+        for (int f = 0; f < frames; f++)
+        {
+            turning.rotate(glm::radians(2.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            uniforms.model = turning.model();
+            rasterizer.clear(glm::vec3(0.2f, 0.2f, 0.3f));
+            rasterizer.draw(mesh, uniforms, shading, &pool);
+        }
+        double fps = frames / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (threads == 1)
+            single = fps;
+        std::cout << threads << " threads: " << fps << " frames/s, " << fps / single << "x" << std::endl;
+    }
+    return 0;
+}
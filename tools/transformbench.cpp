@@ -0,0 +1,99 @@
+// measures the CPU vertex transform with 1 to N threads, and how far a million small rotations
+// drift from orthonormal with TransformState against accumulated glm::rotate matrices; exits
+// with 2 when the TransformState drift is over ORTHONORMAL_TOLERANCE
+// usage: transformbench [model] [minimum vertices]
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "../src/mesh.hpp"
+#include "../src/transform.hpp"
+#include "../src/threadpool.hpp"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <iostream>
+
+// largest |M^T M - I| entry the TransformState model may show after the rotation test
+#define ORTHONORMAL_TOLERANCE 1e-5f
+
+int main(int argc, char** argv)
+{
+    std::string model = argc > 1 ? argv[1] : "head.obj";
+    std::size_t minimumVertices = argc > 2 ? std::stoul(argv[2]) : 1000000;
+
+    // 1. load the model and repeat its vertices until the stream is big enough to split
+    FileIOSystem data("../data/");
+    Mesh mesh(model.c_str(), ATTRIB_POSITION | ATTRIB_NORMAL, &data);
+    mesh.buildIndices(false);
+    if (mesh.indexedVertices.empty())
+        return 1;
+    unsigned int step = mesh.stride();
+    std::vector<glm::vec3> vertices;
+    while (vertices.size() / step < minimumVertices)
+        vertices.insert(vertices.end(), mesh.indexedVertices.begin(), mesh.indexedVertices.end());
+    VertexSoA source;
+    source.assign(vertices, step);
+    std::vector<glm::vec3> out(vertices.size());
+    glm::mat4 transform = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f, -1.0f, 2.0f)), 0.7f, glm::vec3(0.0f, 1.0f, 0.0f));
+
+    std::cout << model << ": " << source.count << " vertices, " << transformPath() << ", chunks of " << TRANSFORM_CHUNK << std::endl;
+
+    // 2. the same job on pools of 1 to N threads
+    unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    double single = 0.0;
+    for (unsigned int threads = 1; threads <= maxThreads; threads++)
+    {
+        ThreadPool pool(threads);
+        auto task = [&](std::size_t first, std::size_t last)
+        {
+            transformVertices(source, first, last, transform, &out[0].x, step);
+        };
+        pool.parallelFor(source.count, TRANSFORM_CHUNK, task); // warm up
+
+        const int repeats = 50;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++)
+            pool.parallelFor(source.count, TRANSFORM_CHUNK, task);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+        double rate = source.count / seconds / 1e6;
+        if (threads == 1)
+            single = rate;
+        std::cout << threads << " threads: " << seconds * 1000.0 << " ms, " << rate << " million vertices/s, "
+                  << rate / single << "x" << std::endl;
+    }
+
+    // 3. a million rotation steps, switching axes every thousand as when keys are held for a long time
+    auto drift = [](const glm::mat4& m)
+    {
+        glm::mat3 error = glm::transpose(glm::mat3(m)) * glm::mat3(m) - glm::mat3(1.0f);
+        float largest = 0.0f;
+        for (int c = 0; c < 3; c++)
+            for (int r = 0; r < 3; r++)
+                largest = std::max(largest, std::abs(error[c][r]));
+        return largest;
+    };
+    const glm::vec3 axes[] = { glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f) };
+    const int steps = 1000000;
+    TransformState state;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+        state.rotate(glm::radians(1.3f), axes[i / 1000 % 3]);
+    double stateNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / steps;
+    glm::mat4 accumulated(1.0f);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++)
+        accumulated = glm::rotate(accumulated, glm::radians(1.3f), axes[i / 1000 % 3]);
+    double matrixNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / steps;
+    float stateDrift = drift(state.model());
+    std::cout << steps << " rotations: TransformState " << stateNs << " ns each, off orthonormal by " << stateDrift
+              << "; glm::rotate matrices " << matrixNs << " ns each, off by " << drift(accumulated) << std::endl;
+    // NaN fails as well
+    if (!(stateDrift <= ORTHONORMAL_TOLERANCE))
+    {
+        std::cout << "ERROR::TRANSFORMBENCH::DRIFT " << stateDrift << " over the tolerance of " << ORTHONORMAL_TOLERANCE << std::endl;
+        return 2;
+    }
+    return 0;
+}